@@ -49,12 +49,30 @@
 #define	METANAME_LUACARRAYTYPE	"luacarraytype" LUACS_VARIANT
 #define	METANAME_LUACSTRUCTOBJ	"luacstructobj" LUACS_VARIANT
 #define	METANAME_LUACSENUMVAL	"luacenumval" LUACS_VARIANT
-#define	METANAME_LUACSUSERTABLE	"luacusertable" LUACS_VARIANT
+#define	METANAME_LUACFIELDHANDLE	"luacfieldhandle" LUACS_VARIANT
 
-#define	LUACS_REGISTRY_NAME	"luacstruct_registry"
+
+#define	LUACS_FIELDCACHESIZ	32	/* must be a power of 2 */
+#define	LUACS_FIELDCACHEMISS	8	/* misses to replace a cache entry */
+#define	LUACS_FIELDHANDLEMAXHOPS	16	/* pointers on a path */
+
+/* flags of the objects, which don't conflict with the ones of the fields */
+#define	LUACS_OFBORROWED	0x1000	/* created by luacs_newborrowed() */
+#define	LUACS_OFUSERTABLE	0x2000	/* has the user table */
+#define	LUACS_OFINBORROWED	0x4000	/* nested in a borrowed object */
+
+/* the reductions of the integer arrays */
+#define	LUACS_AOPSUM		0
+#define	LUACS_AOPMIN		1
+#define	LUACS_AOPMAX		2
+
+/* flips the sign of the keys to order the signed integers as unsigned */
+#define	LUACS_KEYSIGNBIT	((uint64_t)1 << 63)
 
 #if LUA_VERSION_NUM == 501
 #define	lua_rawlen(_x, _i)	lua_objlen((_x), (_i))
+#define	lua_getuservalue(_x, _i)	lua_getfenv((_x), (_i))
+#define	lua_setuservalue(_x, _i)	lua_setfenv((_x), (_i))
 #define lua_absindex(_L, _i)	(((_i) > 0 || (_i) <= LUA_REGISTRYINDEX) \
 				    ? (_i) : lua_gettop(_L) + (_i) + 1)
 #endif
@@ -143,9 +161,24 @@
 struct luacstruct {
 	const char			*typename;
 	char				 metaname[METANAMELEN];
-	SPLAY_HEAD(luacstruct_fields, luacstruct_field)
-					 fields;
+	struct luacstruct_fieldent	*fields;
+	unsigned			 fieldsmask;
+	int				 nfields;
 	TAILQ_HEAD(,luacstruct_field)	 sorted;
+	struct luacstruct_field		**fieldv;	/* sorted as a vector */
+	int				 nfieldv;
+	int				 fieldvref;	/* names of fieldv */
+	struct {
+		const char		*key;
+		struct luacstruct_field	*field;
+		unsigned		 misses;
+	}				 fieldcache[LUACS_FIELDCACHESIZ];
+	int				 fieldcacheref;
+	size_t				 size;		/* of an instance */
+	const void			*meta;		/* metatable of objects */
+	int				 metaref;	/* for the type handle */
+	int				 identref;	/* objects by pointers */
+	int				 nslots;	/* of the user table */
 };
 
 struct luacarraytype {
@@ -158,12 +191,23 @@ struct luacarraytype {
 	unsigned			 flags;
 };
 
+struct luacobject;
+struct luacregion;
+
+struct luacregion_accessor {
+	int	(*get)(lua_State *, struct luacobject *, struct luacregion *);
+	void	(*set)(lua_State *, struct luacobject *, struct luacregion *,
+		    int);
+};
+
 struct luacregion {
 	enum luacstruct_type		 type;
 	int				 off;
 	size_t				 size;
 	int				 typref;
 	unsigned			 flags;
+	const struct luacregion_accessor
+					*acc;
 };
 
 struct luacstruct_field {
@@ -174,10 +218,16 @@ struct luacstruct_field {
 	int				 nmemb;
 	unsigned			 flags;
 	int				 ref;
-	SPLAY_ENTRY(luacstruct_field)	 tree;
+	int				 ordinal;	/* index of fieldv */
+	int				 slot;		/* of the user table */
 	TAILQ_ENTRY(luacstruct_field)	 queue;
 };
 
+struct luacstruct_fieldent {
+	uint32_t			 hash;
+	struct luacstruct_field		*field;
+};
+
 struct luacobject {
 	enum luacstruct_type		 type;
 	struct luacstruct		*cs;
@@ -186,6 +236,16 @@ struct luacobject {
 	int				 nmemb;
 	int				 typref;
 	unsigned			 flags;
+	const struct luacregion_accessor
+					*acc;		/* for arrays */
+};
+
+struct luacfieldhandle {
+	struct luacstruct		*cs;
+	int				 csref;
+	struct luacregion		 region;	/* the leaf */
+	int				 nhops;
+	int				 hops[1];	/* offsets of pointers */
 };
 
 struct luacenum {
@@ -211,14 +271,27 @@ struct luacenum_value {
 
 static struct luacstruct
 		*luacs_checkstruct(lua_State *, int);
-static int	 luacs_usertable(lua_State *, int);
-static int	 luacs_deleteusertable(lua_State *, int);
+static int	 luacs_usertable(lua_State *, int, int);
 static int	 luacs_struct__gc(lua_State *);
+static int	 luacs_struct__index(lua_State *);
+static int	 luacs_struct_ordinal(lua_State *);
+static void	 luacs_struct_newmeta(lua_State *, struct luacstruct *);
+static void	 luacs_struct_setmember(lua_State *, int,
+		    struct luacstruct_field *);
 static struct luacstruct_field
 		*luacs_declare(lua_State *, enum luacstruct_type, const char *,
 		    const char *, size_t, int, int, unsigned);
-static int	 luacstruct_field_cmp(struct luacstruct_field *,
+static struct luacstruct_field
+		*luacs_findfield(struct luacstruct *, const char *);
+static struct luacstruct_field
+		*luacs_lookupfield(lua_State *, struct luacstruct *, int);
+static void	 luacs_insertfield(lua_State *, struct luacstruct *,
+		    struct luacstruct_field *);
+static struct luacstruct_field
+		**luacs_fieldv(lua_State *, struct luacstruct *);
+static void	 luacs_removefield(struct luacstruct *,
 		    struct luacstruct_field *);
+static uint32_t	 luacs_strhash(const char *);
 static struct luacstruct_field
 		*luacsfield_copy(lua_State *, struct luacstruct_field *);
 static void	 luacstruct_field_free(lua_State *, struct luacstruct *,
@@ -231,11 +304,46 @@ static int	 luacs_array__len(lua_State *);
 static int	 luacs_array__index(lua_State *);
 static int	 luacs_array__newindex(lua_State *);
 static int	 luacs_array_copy(lua_State *);
+static bool	 luacs_array_copyplain(struct luacobject *,
+		    struct luacobject *);
 static int	 luacs_array__next(lua_State *);
 static int	 luacs_array__pairs(lua_State *);
 static int	 luacs_array__ipairs(lua_State *);
 static int	 luacs_array__gc(lua_State *);
+static int	 luacs_array_slice(lua_State *);
+static int	 luacs_array_fromtable(lua_State *);
+static int	 luacs_array_fromtable0(lua_State *);
+static int	 luacs_array_reduce(lua_State *);
+static int	 luacs_array_fill(lua_State *);
+static int	 luacs_array_find(lua_State *);
+static struct luacobject
+		*luacs_checkintarray(lua_State *, const char *);
+static bool	 luacs_intinrange(enum luacstruct_type, size_t, int64_t);
+static uint64_t	 luacs_loadintkey(const void *, enum luacstruct_type, bool);
+static int	 luacs_sortkeytype(enum luacstruct_type, size_t);
+static int	 luacs_array_sort(lua_State *);
+static int	 luacs_array_sort_by(lua_State *);
+static void	 luacs_array_sort0(lua_State *, struct luacobject *, int,
+		    enum luacstruct_type, bool, bool);
+static int	 luacs_sortkey_cmp(const void *, const void *);
+static int	 luacs_sortkey_rcmp(const void *, const void *);
+static int	 luacs_array_bsearch(lua_State *);
+static int	 luacs_array_totable(lua_State *);
+static void	 luacs_totable(lua_State *, lua_CFunction, int);
 static int	 luacs_newobject0(lua_State *, void *);
+static int	 luacs_newobject1(lua_State *, struct luacstruct *, void *,
+		    unsigned);
+static struct luacobject
+		*luacs_checkobj0(lua_State *, int);
+static struct luacobject
+		*luacs_checkobj(lua_State *, int);
+static struct luacobject
+		*luacs_checkobj_mt(lua_State *, int, int);
+static struct luacobject
+		*luacs_checkarray(lua_State *, int, int);
+static void	 luacs_nestborrowed(lua_State *, struct luacobject *);
+static void	 luacs_releasenested(lua_State *, int, bool);
+static void	 luacs_releasenested0(lua_State *, int, bool);
 static int	 luacs_object__luacstructdump(struct lua_State *);
 struct luacobj_compat;
 static void	 luacs_object_compat(lua_State *, int, struct luacobj_compat *);
@@ -246,13 +354,63 @@ static int	 luacs_object__get(lua_State *, struct luacobject *,
 		    struct luacstruct_field *);
 static int	 luacs_object__newindex(lua_State *);
 static int	 luacs_object_copy(lua_State *);
+static int	 luacs_object_get(lua_State *);
+static int	 luacs_object_set(lua_State *);
+static int	 luacs_object_totable(lua_State *);
+static int	 luacs_object_fromtable0(lua_State *);
+static void	 luacs_object_fromtable1(lua_State *, struct luacobject *,
+		    int, int);
 static int	 luacs_object__next(lua_State *);
 static int	 luacs_object__pairs(lua_State *);
 static int	 luacs_object__gc(lua_State *);
+static void	 luacs_resolvepath(lua_State *, struct luacstruct *,
+		    const char *, struct luacregion *, int *, int *);
+static int	 luacs_struct_field(lua_State *);
+static struct luacfieldhandle
+		*luacs_fieldhandle_base(lua_State *, caddr_t *);
+static int	 luacs_fieldhandle_get(lua_State *);
+static int	 luacs_fieldhandle_set(lua_State *);
+static int	 luacs_fieldhandle__gc(lua_State *);
 static int	 luacs_pushregion(lua_State *, struct luacobject *,
 		    struct luacregion *);
 static void	 luacs_pullregion(lua_State *, struct luacobject *,
 		    struct luacregion *, int);
+static const struct luacregion_accessor
+		*luacs_region_accessor(enum luacstruct_type, size_t, unsigned);
+static int	 luacs_get_bool(lua_State *, struct luacobject *,
+		    struct luacregion *);
+static void	 luacs_set_bool(lua_State *, struct luacobject *,
+		    struct luacregion *, int);
+static int	 luacs_get_string(lua_State *, struct luacobject *,
+		    struct luacregion *);
+static void	 luacs_set_string(lua_State *, struct luacobject *,
+		    struct luacregion *, int);
+static int	 luacs_get_strptr(lua_State *, struct luacobject *,
+		    struct luacregion *);
+static void	 luacs_set_strptr(lua_State *, struct luacobject *,
+		    struct luacregion *, int);
+static int	 luacs_get_wstring(lua_State *, struct luacobject *,
+		    struct luacregion *);
+static void	 luacs_set_wstring(lua_State *, struct luacobject *,
+		    struct luacregion *, int);
+static int	 luacs_get_wstrptr(lua_State *, struct luacobject *,
+		    struct luacregion *);
+static void	 luacs_set_wstrptr(lua_State *, struct luacobject *,
+		    struct luacregion *, int);
+static int	 luacs_get_bytearray(lua_State *, struct luacobject *,
+		    struct luacregion *);
+static void	 luacs_set_bytearray(lua_State *, struct luacobject *,
+		    struct luacregion *, int);
+static int	 luacs_get_enum_broken(lua_State *, struct luacobject *,
+		    struct luacregion *);
+static void	 luacs_set_enum_broken(lua_State *, struct luacobject *,
+		    struct luacregion *, int);
+static int	 luacs_get_none(lua_State *, struct luacobject *,
+		    struct luacregion *);
+static void	 luacs_set_none(lua_State *, struct luacobject *,
+		    struct luacregion *, int);
+static int	 luacs_pushenum(lua_State *, struct luacregion *, intmax_t);
+static intmax_t	 luacs_toenum(lua_State *, struct luacregion *, int);
 struct luacenum	*luacs_checkenum(lua_State*, int);
 struct luacenum_value
 		*luacs_enum_get0(struct luacenum *, intmax_t);
@@ -275,17 +433,35 @@ static int	 luacenum_value_cmp(struct luacenum_value *,
 static int	 luacs_ref(lua_State *);
 static int	 luacs_getref(lua_State *, int);
 static int	 luacs_unref(lua_State *, int);
+static void	 luacs_pushregistry(lua_State *);
+
 static int	 luacs_pushwstring(lua_State *, const wchar_t *);
 
-SPLAY_PROTOTYPE(luacstruct_fields, luacstruct_field, tree,
-    luacstruct_field_cmp);
 SPLAY_PROTOTYPE(luacenum_labels, luacenum_value, treel, luacenum_label_cmp);
 SPLAY_PROTOTYPE(luacenum_values, luacenum_value, treev, luacenum_value_cmp);
 
+/*
+ * The table for the references is stored in the Lua registry keyed by the
+ * address of this variable to avoid looking up by a string.
+ */
+static const char	 luacs_registry_key = 0;
+
 
 /* Declare a new struct */
 int
 luacs_newstruct0(lua_State *L, const char *tname, const char *supertname)
+{
+	return (luacs_newstruct1(L, tname, supertname, 0));
+}
+
+/*
+ * Same as luacs_newstruct0(), but the size of the struct is specified.  The
+ * objects owning the instances are allocated with the size, otherwise with
+ * the size covering the declared fields.
+ */
+int
+luacs_newstruct1(lua_State *L, const char *tname, const char *supertname,
+    size_t size)
 {
 	int			 ret;
 	struct luacstruct	*cs, *supercs = NULL;
@@ -298,6 +474,7 @@ luacs_newstruct0(lua_State *L, const char *tname, const char *supertname)
 	lua_getfield(L, LUA_REGISTRYINDEX, metaname);
 	if (!lua_isnil(L, -1)) {
 		cs = luacs_checkstruct(L, -1);
+		cs->size = MAXIMUM(cs->size, size);
 		return (1);
 	}
 	lua_pop(L, 1);
@@ -325,8 +502,20 @@ luacs_newstruct0(lua_State *L, const char *tname, const char *supertname)
 	    sizeof(cs->metaname)));
 
 	cs->typename = strchr(cs->metaname, '.') + 1;
-	SPLAY_INIT(&cs->fields);
+	cs->fields = NULL;
+	cs->fieldsmask = 0;
+	cs->nfields = 0;
 	TAILQ_INIT(&cs->sorted);
+	memset(cs->fieldcache, 0, sizeof(cs->fieldcache));
+	cs->fieldcacheref = 0;
+	cs->fieldv = NULL;
+	cs->nfieldv = 0;
+	cs->fieldvref = 0;
+	cs->size = size;
+	cs->metaref = 0;
+	cs->identref = 0;
+	cs->nslots = 0;
+	luacs_struct_newmeta(L, cs);
 
 	/* Inherit from the super struct if specified */
 	if (supercs != NULL) {
@@ -338,17 +527,20 @@ luacs_newstruct0(lua_State *L, const char *tname, const char *supertname)
 				return (0);	/* not reached */
 			}
 			TAILQ_INSERT_TAIL(&cs->sorted, fieldt, queue);
-			SPLAY_INSERT(luacstruct_fields, &cs->fields, fieldt);
+			luacs_insertfield(L, cs, fieldt);
+			luacs_struct_setmember(L, -1, fieldt);
 		}
+		cs->size = MAXIMUM(cs->size, supercs->size);
+		cs->nslots = supercs->nslots;
 		lua_remove(L, -2);
 	}
 
 	if ((ret = luaL_newmetatable(L, METANAME_LUACSTRUCT)) != 0) {
 		lua_pushcfunction(L, luacs_struct__gc);
 		lua_setfield(L, -2, "__gc");
+		lua_pushcfunction(L, luacs_struct__index);
+		lua_setfield(L, -2, "__index");
 	}
-	lua_pushvalue(L, -1);
-	lua_setfield(L, -2, "__index");
 	lua_setmetatable(L, -2);
 
 	return (1);
@@ -358,86 +550,255 @@ int
 luacs_delstruct(lua_State *L, const char *tname)
 {
 	char			 metaname[METANAMELEN];
+	struct luacstruct	*cs;
 
 	snprintf(metaname, sizeof(metaname), "%s%s", METANAME_LUACTYPE, tname);
+	lua_getfield(L, LUA_REGISTRYINDEX, metaname);
+	if (!lua_isnil(L, -1)) {
+		/* the type handle is invalidated */
+		cs = luacs_checkstruct(L, -1);
+		if (cs->metaref != 0)
+			luacs_unref(L, cs->metaref);
+		cs->metaref = 0;
+	}
+	lua_pop(L, 1);
 	lua_pushnil(L);
 	lua_setfield(L, LUA_REGISTRYINDEX, metaname);
 
 	return (0);
 }
 
+/*
+ * Get the handle of the struct of the name, which is used instead of the
+ * name to create or check the objects without looking up the name.  The
+ * handle is valid until luacs_delstruct() is called for the struct.  NULL is
+ * returned if the struct is not declared.
+ */
+luacs_typehandle_t
+luacs_gettype(lua_State *L, const char *tname)
+{
+	char			 metaname[METANAMELEN];
+	struct luacstruct	*cs = NULL;
+
+	snprintf(metaname, sizeof(metaname), "%s%s", METANAME_LUACTYPE, tname);
+	lua_getfield(L, LUA_REGISTRYINDEX, metaname);
+	if (!lua_isnil(L, -1)) {
+		cs = luacs_checkstruct(L, -1);
+		if (cs->metaref == 0) {
+			/* the metatable keeps the struct */
+			lua_getuservalue(L, -1);
+			cs->metaref = luacs_ref(L);
+		}
+	}
+	lua_pop(L, 1);
+
+	return (cs);
+}
+
 struct luacstruct *
 luacs_checkstruct(lua_State *L, int csidx)
 {
 	return (luaL_checkudata(L, csidx, METANAME_LUACSTRUCT));
 }
 
+/*
+ * Push the user table of the object, which caches the objects for the
+ * nested structs and arrays and keeps the values of the extref and pseudo
+ * fields by the slots of the fields or the indices of the array.  It is the
+ * uservalue of the object, created on the first use with `nslots' in the
+ * array part.  Lua 5.1 always gives an environment to a userdata, so the
+ * flag tells whether the table is ours.
+ */
 int
-luacs_usertable(lua_State *L, int idx)
+luacs_usertable(lua_State *L, int idx, int nslots)
 {
-	int	 absidx;
+	struct luacobject	*obj;
+	int			 absidx;
 
 	absidx = lua_absindex(L, idx);
-
-	lua_getfield(L, LUA_REGISTRYINDEX, METANAME_LUACSUSERTABLE);
-	if (lua_isnil(L, -1)) {
-		/* Create a weak table */
-		lua_pop(L, 1);
-		lua_newtable(L);
-		lua_newtable(L);
-		lua_pushstring(L, "k");
-		lua_setfield(L, -2, "__mode");
-		lua_setmetatable(L, -2);
-		lua_setfield(L, LUA_REGISTRYINDEX, METANAME_LUACSUSERTABLE);
-		lua_getfield(L, LUA_REGISTRYINDEX, METANAME_LUACSUSERTABLE);
-	}
-	lua_pushvalue(L, absidx);
-	lua_gettable(L, -2);
-	if (lua_isnil(L, -1)) {
-		/* Create a new table which is weakly refered by the userdata */
-		lua_pop(L, 1);
-		lua_newtable(L);
-		lua_pushvalue(L, absidx);
-		lua_pushvalue(L, -2);
-		lua_settable(L, -4);
+	obj = lua_touserdata(L, absidx);
+	if ((obj->flags & LUACS_OFUSERTABLE) != 0)
+		lua_getuservalue(L, absidx);
+	else {
+		lua_createtable(L, nslots, 0);
+		lua_pushvalue(L, -1);
+		lua_setuservalue(L, absidx);
+		obj->flags |= LUACS_OFUSERTABLE;
 	}
-	lua_remove(L, -2);
 
 	return (1);
 }
 
 int
-luacs_deleteusertable(lua_State *L, int idx)
+luacs_struct__gc(lua_State *L)
 {
-	int	 absidx;
+	struct luacstruct	*cs;
+	struct luacstruct_field	*field;
 
-	absidx = lua_absindex(L, idx);
-	lua_getfield(L, LUA_REGISTRYINDEX, METANAME_LUACSUSERTABLE);
-	if (!lua_isnil(L, -1)) {
-		lua_pushvalue(L, absidx);
-		lua_pushnil(L);
-		lua_settable(L, -3);
+	lua_settop(L, 1);
+	cs = luacs_checkstruct(L, 1);
+	if (cs) {
+		while ((field = TAILQ_FIRST(&cs->sorted)) != NULL)
+			luacstruct_field_free(L, cs, field);
+		free(cs->fields);
+		cs->fields = NULL;
+		free(cs->fieldv);
+		cs->fieldv = NULL;
+		if (cs->fieldvref != 0)
+			luacs_unref(L, cs->fieldvref);
+		cs->fieldvref = 0;
+		if (cs->fieldcacheref != 0)
+			luacs_unref(L, cs->fieldcacheref);
+		cs->fieldcacheref = 0;
+		if (cs->identref != 0)
+			luacs_unref(L, cs->identref);
+		cs->identref = 0;
+	}
+
+	return (0);
+}
+
+/*
+ * The functions of the struct, which take the struct as the upvalue, so
+ * that they are called like T.field(path) or T.ordinal(name).
+ */
+int
+luacs_struct__index(lua_State *L)
+{
+	const char	*key;
+
+	lua_settop(L, 2);
+	luacs_checkstruct(L, 1);
+	key = (lua_type(L, 2) == LUA_TSTRING)? lua_tostring(L, 2) : NULL;
+	if (key != NULL && strcmp(key, "field") == 0) {
+		lua_pushvalue(L, 1);
+		lua_pushcclosure(L, luacs_struct_field, 1);
+	} else if (key != NULL && strcmp(key, "ordinal") == 0) {
+		lua_pushvalue(L, 1);
+		lua_pushcclosure(L, luacs_struct_ordinal, 1);
+	} else {
+		lua_getmetatable(L, 1);
+		lua_pushvalue(L, 2);
+		lua_rawget(L, -2);
 	}
-	lua_pop(L, 1);
 
 	return (1);
 }
 
+/*
+ * T.ordinal(name) returns the ordinal of the field, which can be used as the
+ * key instead of the name.  It is valid until the struct is modified.
+ */
 int
-luacs_struct__gc(lua_State *L)
+luacs_struct_ordinal(lua_State *L)
 {
 	struct luacstruct	*cs;
 	struct luacstruct_field	*field;
 
-	lua_settop(L, 1);
-	cs = luacs_checkstruct(L, 1);
-	if (cs) {
-		while ((field = SPLAY_MIN(luacstruct_fields, &cs->fields)) !=
-		    NULL)
-			luacstruct_field_free(L, cs, field);
+	cs = luacs_checkstruct(L, lua_upvalueindex(1));
+	luacs_fieldv(L, cs);
+	if ((field = luacs_findfield(cs, luaL_checkstring(L, 1))) != NULL)
+		lua_pushinteger(L, field->ordinal + 1);
+	else
+		lua_pushnil(L);
+
+	return (1);
+}
+
+/*
+ * Create the metatable for the objects of the struct.  The metatable is
+ * created per a struct and its __index refers the table of the methods and
+ * the constants of the struct, so that they are resolved without looking up
+ * the fields.  The frequently used metamethods keep the metatable as an
+ * upvalue to check the type of the object by its identity.  The others are
+ * shared by all structs.
+ *
+ * The metatable is kept as the uservalue of the struct, and it keeps the
+ * struct by an upvalue of __newindex in turn, so that the objects keep the
+ * struct alive without taking a reference each.  __gc is set only when the
+ * struct has the method of it, not to finalize the objects needlessly.
+ */
+void
+luacs_struct_newmeta(lua_State *L, struct luacstruct *cs)
+{
+	lua_newtable(L);
+	if (luaL_newmetatable(L, METANAME_LUACSTRUCTOBJ) != 0) {
+		lua_pushcfunction(L, luacs_object__tostring);
+		lua_setfield(L, -2, "__tostring");
+		lua_pushcfunction(L, luacs_object__eq);
+		lua_setfield(L, -2, "__eq");
+		lua_pushcfunction(L, luacs_object__luacstructdump);
+		lua_setfield(L, -2, "__luacstructdump");
+	}
+	/* copy the shared metamethods */
+	lua_pushnil(L);
+	while (lua_next(L, -2) != 0) {
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_rawset(L, -5);
 	}
+	lua_pop(L, 1);
 
-	return (0);
+	lua_pushvalue(L, -1);
+	lua_pushvalue(L, -3);	/* not used, but to keep the struct */
+	lua_pushcclosure(L, luacs_object__newindex, 2);
+	lua_setfield(L, -2, "__newindex");
+	lua_pushvalue(L, -1);
+	lua_pushcclosure(L, luacs_object__pairs, 1);
+	lua_setfield(L, -2, "__pairs");
+
+	lua_newtable(L);
+	/* the builtin methods, the declared names override them */
+	lua_pushvalue(L, -2);
+	lua_pushcclosure(L, luacs_object_get, 1);
+	lua_setfield(L, -2, "get");
+	lua_pushvalue(L, -2);
+	lua_pushcclosure(L, luacs_object_set, 1);
+	lua_setfield(L, -2, "set");
+	lua_pushvalue(L, -2);
+	lua_pushcclosure(L, luacs_object_totable, 1);
+	lua_setfield(L, -2, "totable");
+	lua_pushvalue(L, -2);
+	lua_pushcclosure(L, luacs_object__index, 2);
+	lua_setfield(L, -2, "__index");
+	cs->meta = lua_topointer(L, -1);
+	lua_setuservalue(L, -2);
+}
+
+/*
+ * Update the method or the constant of the name of the field.  The table of
+ * them is the upvalue of __index of the metatable for the objects.
+ */
+void
+luacs_struct_setmember(lua_State *L, int csidx,
+    struct luacstruct_field *field)
+{
+	lua_getuservalue(L, csidx);
+	if (strcmp(field->fieldname, "__gc") == 0) {
+		if (field->type == LUACS_TMETHOD) {
+			lua_pushvalue(L, -1);
+			lua_pushcclosure(L, luacs_object__gc, 1);
+		} else
+			lua_pushnil(L);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_getfield(L, -1, "__index");
+	lua_getupvalue(L, -1, 1);
+	lua_replace(L, -3);
+	lua_pop(L, 1);
+	switch (field->type) {
+	case LUACS_TMETHOD:
+		luacs_getref(L, field->ref);
+		break;
+	case LUACS_TCONST:
+		lua_pushinteger(L, field->constval);
+		break;
+	default:
+		lua_pushnil(L);
+		break;
+	}
+	lua_setfield(L, -2, field->fieldname);
+	lua_pop(L, 1);
 }
 
 int
@@ -470,13 +831,15 @@ luacs_declare(lua_State *L, enum luacstruct_type _type,
 		lua_pushstring(L, buf);
 		lua_error(L);
 	}
-	while ((field0 = SPLAY_FIND(luacstruct_fields, &cs->fields, field))
-	    != NULL)
+	if ((field0 = luacs_findfield(cs, name)) != NULL) {
+		field->slot = field0->slot;
 		luacstruct_field_free(L, cs, field0);
+	}
 	field->region.type = _type;
 	field->region.off = off;
 	field->region.size = siz;
 	field->region.flags = flags;
+	field->region.acc = luacs_region_accessor(_type, siz, flags);
 	field->nmemb = nmemb;
 	field->flags = flags;
 	switch (_type) {
@@ -498,8 +861,22 @@ luacs_declare(lua_State *L, enum luacstruct_type _type,
 		break;
 	}
 	field->type = (field->nmemb > 0)? LUACS_TARRAY : _type;
+	switch (field->type) {
+	case LUACS_TOBJREF:
+	case LUACS_TOBJENT:
+	case LUACS_TEXTREF:
+	case LUACS_TARRAY:
+		/* the slot of the user table to cache the value */
+		if (field->slot == 0)
+			field->slot = ++cs->nslots;
+		break;
+	default:
+		field->slot = 0;
+		break;
+	}
+	cs->size = MAXIMUM(cs->size, off + MAXIMUM(nmemb, 1) * siz);
 
-	SPLAY_INSERT(luacstruct_fields, &cs->fields, field);
+	luacs_insertfield(L, cs, field);
 	TAILQ_FOREACH(field0, &cs->sorted, queue) {
 		if (field->region.off < field0->region.off)
 			break;
@@ -508,6 +885,7 @@ luacs_declare(lua_State *L, enum luacstruct_type _type,
 		TAILQ_INSERT_TAIL(&cs->sorted, field, queue);
 	else
 		TAILQ_INSERT_BEFORE(field0, field, queue);
+	luacs_struct_setmember(L, -1, field);
 
 	return (field);
 }
@@ -521,6 +899,7 @@ luacs_declare_method(lua_State *L, const char *name, int (*func)(lua_State *))
 	    LUACS_FREADONLY);
 	lua_pushcfunction(L, func);
 	field->ref = luacs_ref(L);
+	luacs_struct_setmember(L, -1, field);
 
 	return (0);
 }
@@ -533,58 +912,304 @@ luacs_declare_const(lua_State *L, const char *name, int constval)
 	field = luacs_declare(L, LUACS_TCONST, NULL, name, 0, 0, 0,
 	    LUACS_FREADONLY);
 	field->constval = constval;
+	luacs_struct_setmember(L, -1, field);
+
+	return (0);
+}
+
+/*
+ * Declare a field which is an alias of the field at the path in the nested
+ * structs.  The offset is resolved here, so the nested objects are not
+ * created when accessing it.
+ */
+int
+luacs_declare_alias(lua_State *L, const char *name, const char *path,
+    unsigned flags)
+{
+	struct luacregion	 leaf;
+	struct luacenum		*ce;
+	const char		*tname = NULL;
+
+	luacs_resolvepath(L, luacs_checkstruct(L, -1), path, &leaf, NULL,
+	    NULL);
+	if (leaf.type == LUACS_TENUM) {
+		luacs_getref(L, leaf.typref);
+		ce = luacs_checkenum(L, -1);
+		lua_pop(L, 1);
+		tname = ce->enumname;
+	}
+	luacs_declare(L, leaf.type, tname, name, leaf.size, leaf.off, 0,
+	    leaf.flags | flags);
 
 	return (0);
 }
 
+/*
+ * Make the objects of the struct unique per the pointer of the instance, so
+ * that creating the object for the same pointer returns the same object
+ * while it's alive.  The objects are kept by a weak table, which is dropped
+ * by disabling it.
+ */
 int
-luacstruct_field_cmp(struct luacstruct_field *a, struct luacstruct_field *b)
+luacs_declare_identity(lua_State *L, bool enable)
 {
-	return (strcmp(a->fieldname, b->fieldname));
+	struct luacstruct	*cs;
+
+	cs = luacs_checkstruct(L, -1);
+	if (enable && cs->identref == 0) {
+		lua_newtable(L);
+		lua_newtable(L);
+		lua_pushliteral(L, "v");
+		lua_setfield(L, -2, "__mode");
+		lua_setmetatable(L, -2);
+		cs->identref = luacs_ref(L);
+	} else if (!enable && cs->identref != 0) {
+		luacs_unref(L, cs->identref);
+		cs->identref = 0;
+	}
+
+	return (0);
 }
 
+/*
+ * The fields are indexed by an open addressing hash table which is maintained
+ * when declaring, so looking up a field never modifies the struct.
+ */
 struct luacstruct_field *
-luacsfield_copy(lua_State *L, struct luacstruct_field *from)
+luacs_findfield(struct luacstruct *cs, const char *name)
 {
-	struct luacstruct_field	*to;
+	uint32_t			 hash;
+	unsigned			 i;
+	struct luacstruct_fieldent	*ent;
 
-	to = calloc(1, sizeof(struct luacstruct_field));
-	if (to == NULL)
-		return (NULL);
-	if ((to->fieldname = strdup(from->fieldname)) == NULL) {
-		free(to);
+	if (cs->fields == NULL)
 		return (NULL);
+	hash = luacs_strhash(name);
+	for (i = hash & cs->fieldsmask;; i = (i + 1) & cs->fieldsmask) {
+		ent = &cs->fields[i];
+		if (ent->field == NULL)
+			break;
+		if (ent->hash == hash && strcmp(ent->field->fieldname, name)
+		    == 0)
+			return (ent->field);
 	}
-	to->type = from->type;
-	to->region = from->region;
-	to->constval = from->constval;
-	to->nmemb = from->nmemb;
-	to->flags = from->flags;
-	/* Update refs */
-	if (from->region.typref != 0) {
-		luacs_getref(L, from->region.typref);
-		to->region.typref = luacs_ref(L);
+
+	return (NULL);
+}
+
+/*
+ * Lookup the field by the string at the idx of the stack.  Since Lua interns
+ * short strings, the same key is usually passed by the same pointer.  Cache
+ * the result keyed by the pointer to skip hashing and comparing the string.
+ * The cached keys are referred by a table so that the pointers are not
+ * reused for other strings while they are in the cache.  To avoid thrashing
+ * when many fields are accessed alternately, an entry is replaced only
+ * after missing several times in a row.
+ *
+ * An integer is taken as the ordinal of the field, which is the position in
+ * the fields sorted by the offset.
+ */
+struct luacstruct_field *
+luacs_lookupfield(lua_State *L, struct luacstruct *cs, int idx)
+{
+	const char		*key;
+	unsigned		 slot;
+	struct luacstruct_field	*field;
+	lua_Integer		 ord;
+
+	if (lua_type(L, idx) == LUA_TNUMBER) {
+		ord = lua_tointeger(L, idx);
+		luacs_fieldv(L, cs);
+		return ((1 <= ord && ord <= cs->nfieldv)?
+		    cs->fieldv[ord - 1] : NULL);
 	}
-	if (from->ref != 0) {
-		luacs_getref(L, from->ref);
-		to->ref = luacs_ref(L);
+	key = luaL_checkstring(L, idx);
+	slot = (((uintptr_t)key >> 4) ^ ((uintptr_t)key >> 9)) &
+	    (LUACS_FIELDCACHESIZ - 1);
+	if (cs->fieldcache[slot].key == key) {
+		cs->fieldcache[slot].misses = 0;
+		return (cs->fieldcache[slot].field);
 	}
+	if ((field = luacs_findfield(cs, key)) == NULL)
+		return (NULL);
+	if (cs->fieldcache[slot].key != NULL &&
+	    ++cs->fieldcache[slot].misses < LUACS_FIELDCACHEMISS)
+		return (field);
 
-	return (to);
+	if (cs->fieldcacheref == 0) {
+		lua_createtable(L, LUACS_FIELDCACHESIZ, 0);
+		cs->fieldcacheref = luacs_ref(L);
+	}
+	idx = lua_absindex(L, idx);
+	luacs_getref(L, cs->fieldcacheref);
+	lua_pushvalue(L, idx);
+	lua_rawseti(L, -2, slot + 1);
+	lua_pop(L, 1);
+	cs->fieldcache[slot].key = key;
+	cs->fieldcache[slot].field = field;
+	cs->fieldcache[slot].misses = 0;
+
+	return (field);
 }
 
 void
-luacstruct_field_free(lua_State *L, struct luacstruct *cs,
+luacs_insertfield(lua_State *L, struct luacstruct *cs,
     struct luacstruct_field *field)
 {
-	if (field) {
-		if (field->region.typref > 0)
-			luacs_unref(L, field->region.typref);
-		if (field->ref != 0)
-			luacs_unref(L, field->ref);
-		TAILQ_REMOVE(&cs->sorted, field, queue);
-		SPLAY_REMOVE(luacstruct_fields, &cs->fields, field);
-		free((char *)field->fieldname);
+	unsigned			 i, j, siz;
+	uint32_t			 hash;
+	struct luacstruct_fieldent	*fields;
+	char				 buf[BUFSIZ];
+
+	/* keep the load factor under 1/2 */
+	if (cs->fields == NULL || (unsigned)(cs->nfields + 1) * 2 >
+	    cs->fieldsmask + 1) {
+		siz = (cs->fields == NULL)? 16 : (cs->fieldsmask + 1) * 2;
+		if ((fields = calloc(siz, sizeof(struct luacstruct_fieldent)))
+		    == NULL) {
+			strerror_r(errno, buf, sizeof(buf));
+			lua_pushstring(L, buf);
+			lua_error(L);
+		}
+		if (cs->fields != NULL) {
+			for (i = 0; i <= cs->fieldsmask; i++) {
+				if (cs->fields[i].field == NULL)
+					continue;
+				for (j = cs->fields[i].hash & (siz - 1);
+				    fields[j].field != NULL;
+				    j = (j + 1) & (siz - 1))
+					;
+				fields[j] = cs->fields[i];
+			}
+			free(cs->fields);
+		}
+		cs->fields = fields;
+		cs->fieldsmask = siz - 1;
+	}
+	hash = luacs_strhash(field->fieldname);
+	for (i = hash & cs->fieldsmask; cs->fields[i].field != NULL;
+	    i = (i + 1) & cs->fieldsmask)
+		LUACS_ASSERT(L, cs->fields[i].field != field);
+	cs->fields[i].hash = hash;
+	cs->fields[i].field = field;
+	cs->nfields++;
+	free(cs->fieldv);
+	cs->fieldv = NULL;
+}
+
+void
+luacs_removefield(struct luacstruct *cs, struct luacstruct_field *field)
+{
+	unsigned	 i, j, k;
+
+	if (cs->fields == NULL)
+		return;
+	for (i = luacs_strhash(field->fieldname) & cs->fieldsmask;
+	    cs->fields[i].field != field; i = (i + 1) & cs->fieldsmask) {
+		if (cs->fields[i].field == NULL)
+			return;
+	}
+	/* move back the following entries to fill the hole */
+	for (j = i;;) {
+		j = (j + 1) & cs->fieldsmask;
+		if (cs->fields[j].field == NULL)
+			break;
+		k = cs->fields[j].hash & cs->fieldsmask;
+		if ((i < j)? (k <= i || j < k) : (k <= i && j < k)) {
+			cs->fields[i] = cs->fields[j];
+			i = j;
+		}
+	}
+	cs->fields[i].field = NULL;
+	cs->nfields--;
+	/* the cache may point the field */
+	memset(cs->fieldcache, 0, sizeof(cs->fieldcache));
+	free(cs->fieldv);
+	cs->fieldv = NULL;
+}
+
+/*
+ * Get the fields sorted by the offset as a vector.  The table referred by
+ * fieldvref also has their names in the same order.
+ */
+struct luacstruct_field **
+luacs_fieldv(lua_State *L, struct luacstruct *cs)
+{
+	int			 n = 0;
+	struct luacstruct_field	*field;
+	char			 buf[BUFSIZ];
+
+	if (cs->fieldv != NULL)
+		return (cs->fieldv);
+	TAILQ_FOREACH(field, &cs->sorted, queue)
+		n++;
+	if ((cs->fieldv = calloc(MAXIMUM(n, 1),
+	    sizeof(struct luacstruct_field *))) == NULL) {
+		strerror_r(errno, buf, sizeof(buf));
+		lua_pushstring(L, buf);
+		lua_error(L);
+	}
+	if (cs->fieldvref == 0) {
+		lua_createtable(L, n, 0);
+		cs->fieldvref = luacs_ref(L);
+	}
+	luacs_getref(L, cs->fieldvref);
+	n = 0;
+	TAILQ_FOREACH(field, &cs->sorted, queue) {
+		field->ordinal = n;
+		cs->fieldv[n++] = field;
+		lua_pushstring(L, field->fieldname);
+		lua_rawseti(L, -2, n);
+	}
+	lua_pop(L, 1);
+	cs->nfieldv = n;
+
+	return (cs->fieldv);
+}
+
+struct luacstruct_field *
+luacsfield_copy(lua_State *L, struct luacstruct_field *from)
+{
+	struct luacstruct_field	*to;
+
+	to = calloc(1, sizeof(struct luacstruct_field));
+	if (to == NULL)
+		return (NULL);
+	if ((to->fieldname = strdup(from->fieldname)) == NULL) {
+		free(to);
+		return (NULL);
+	}
+	to->type = from->type;
+	to->region = from->region;
+	to->constval = from->constval;
+	to->nmemb = from->nmemb;
+	to->flags = from->flags;
+	to->slot = from->slot;
+	/* Update refs */
+	if (from->region.typref != 0) {
+		luacs_getref(L, from->region.typref);
+		to->region.typref = luacs_ref(L);
+	}
+	if (from->ref != 0) {
+		luacs_getref(L, from->ref);
+		to->ref = luacs_ref(L);
+	}
+
+	return (to);
+}
+
+void
+luacstruct_field_free(lua_State *L, struct luacstruct *cs,
+    struct luacstruct_field *field)
+{
+	if (field) {
+		if (field->region.typref > 0)
+			luacs_unref(L, field->region.typref);
+		if (field->ref != 0)
+			luacs_unref(L, field->ref);
+		TAILQ_REMOVE(&cs->sorted, field, queue);
+		luacs_removefield(cs, field);
+		free((char *)field->fieldname);
 	}
 	free(field);
 }
@@ -646,6 +1271,7 @@ luacs_newarraytype(lua_State *L, const char *tname, enum luacstruct_type _type,
 	cat->size = size;
 	cat->nmemb = nmemb;
 	cat->flags = flags;
+	cat->typref = 0;
 
 	switch (_type) {
 	case LUACS_TOBJREF:
@@ -731,7 +1357,9 @@ luacs_newarray0(lua_State *L, enum luacstruct_type _type, int typidx,
 	obj->type =_type;
 	obj->size = size;
 	obj->nmemb = nmemb;
+	obj->typref = 0;
 	obj->flags = flags;
+	obj->acc = luacs_region_accessor(_type, size, flags);
 
 	if (typidx != 0) {
 		lua_pushvalue(L, absidx);
@@ -739,19 +1367,69 @@ luacs_newarray0(lua_State *L, enum luacstruct_type _type, int typidx,
 	}
 
 	if ((ret = luaL_newmetatable(L, METANAME_LUACARRAY)) != 0) {
-		lua_pushcfunction(L, luacs_array__len);
+		/* the metamethods keep the metatable to check the type */
+		lua_pushvalue(L, -1);
+		lua_pushcclosure(L, luacs_array__len, 1);
 		lua_setfield(L, -2, "__len");
-		lua_pushcfunction(L, luacs_array__index);
+		lua_pushvalue(L, -1);
+		lua_newtable(L);
+		/* the methods, which are given by non-integer keys */
+		lua_pushvalue(L, -2);
+		lua_pushcclosure(L, luacs_array_slice, 1);
+		lua_setfield(L, -2, "slice");
+		lua_pushvalue(L, -2);
+		lua_pushcclosure(L, luacs_array_totable, 1);
+		lua_setfield(L, -2, "totable");
+		lua_pushvalue(L, -2);
+		lua_pushcclosure(L, luacs_array_fromtable, 1);
+		lua_setfield(L, -2, "fromtable");
+		lua_pushvalue(L, -2);
+		lua_pushinteger(L, LUACS_AOPSUM);
+		lua_pushcclosure(L, luacs_array_reduce, 2);
+		lua_setfield(L, -2, "sum");
+		lua_pushvalue(L, -2);
+		lua_pushinteger(L, LUACS_AOPMIN);
+		lua_pushcclosure(L, luacs_array_reduce, 2);
+		lua_setfield(L, -2, "min");
+		lua_pushvalue(L, -2);
+		lua_pushinteger(L, LUACS_AOPMAX);
+		lua_pushcclosure(L, luacs_array_reduce, 2);
+		lua_setfield(L, -2, "max");
+		lua_pushvalue(L, -2);
+		lua_pushcclosure(L, luacs_array_fill, 1);
+		lua_setfield(L, -2, "fill");
+		lua_pushvalue(L, -2);
+		lua_pushboolean(L, 1);
+		lua_pushcclosure(L, luacs_array_find, 2);
+		lua_setfield(L, -2, "count");
+		lua_pushvalue(L, -2);
+		lua_pushboolean(L, 0);
+		lua_pushcclosure(L, luacs_array_find, 2);
+		lua_setfield(L, -2, "find");
+		lua_pushvalue(L, -2);
+		lua_pushcclosure(L, luacs_array_sort, 1);
+		lua_setfield(L, -2, "sort");
+		lua_pushvalue(L, -2);
+		lua_pushcclosure(L, luacs_array_sort_by, 1);
+		lua_setfield(L, -2, "sort_by");
+		lua_pushvalue(L, -2);
+		lua_pushcclosure(L, luacs_array_bsearch, 1);
+		lua_setfield(L, -2, "bsearch");
+		lua_pushcclosure(L, luacs_array__index, 2);
 		lua_setfield(L, -2, "__index");
-		lua_pushcfunction(L, luacs_array__newindex);
+		lua_pushvalue(L, -1);
+		lua_pushcclosure(L, luacs_array__newindex, 1);
 		lua_setfield(L, -2, "__newindex");
-		lua_pushcfunction(L, luacs_array__next);
+		lua_pushvalue(L, -1);
+		lua_pushcclosure(L, luacs_array__next, 1);
 		lua_pushcclosure(L, luacs_array__pairs, 1);
 		lua_setfield(L, -2, "__pairs");
-		lua_pushcfunction(L, luacs_array__next);
+		lua_pushvalue(L, -1);
+		lua_pushcclosure(L, luacs_array__next, 1);
 		lua_pushcclosure(L, luacs_array__ipairs, 1);
 		lua_setfield(L, -2, "__ipairs");
-		lua_pushcfunction(L, luacs_array__gc);
+		lua_pushvalue(L, -1);
+		lua_pushcclosure(L, luacs_array__gc, 1);
 		lua_setfield(L, -2, "__gc");
 	}
 	lua_setmetatable(L, -2);
@@ -765,7 +1443,7 @@ luacs_array__len(lua_State *L)
 	struct luacobject	*obj;
 
 	lua_settop(L, 1);
-	obj = luaL_checkudata(L, 1, METANAME_LUACARRAY);
+	obj = luacs_checkarray(L, 1, lua_upvalueindex(1));
 	lua_pushinteger(L, obj->nmemb);
 
 	return (1);
@@ -781,7 +1459,15 @@ luacs_array__index(lua_State *L)
 	void			*ptr;
 
 	lua_settop(L, 2);
-	obj = luaL_checkudata(L, 1, METANAME_LUACARRAY);
+	obj = luacs_checkarray(L, 1, lua_upvalueindex(1));
+	if (lua_type(L, 2) == LUA_TSTRING && lua_istable(L,
+	    lua_upvalueindex(2))) {
+		lua_pushvalue(L, 2);
+		lua_rawget(L, lua_upvalueindex(2));
+		if (!lua_isnil(L, -1))
+			return (1);
+		lua_pop(L, 1);
+	}
 	idx = luaL_checkinteger(L, 2);
 	if (idx < 1 || obj->nmemb < idx) {
 		lua_pushnil(L);
@@ -793,6 +1479,8 @@ luacs_array__index(lua_State *L)
 	region.off = (idx - 1) * obj->size;
 	region.size = obj->size;
 	region.typref = obj->typref;
+	region.flags = obj->flags;
+	region.acc = obj->acc;
 
 	switch (obj->type)  {
 	default:
@@ -807,12 +1495,14 @@ luacs_array__index(lua_State *L)
 		if (ptr == NULL)
 			lua_pushnil(L);
 		else {
-			luacs_usertable(L, 1);
+			luacs_usertable(L, 1, obj->nmemb);
 			lua_rawgeti(L, -1, idx);
 			if (lua_isnil(L, -1)) {
 				lua_pop(L, 1);
 				luacs_getref(L, obj->typref);
 				luacs_newobject0(L, ptr);
+				if (obj->type == LUACS_TOBJENT)
+					luacs_nestborrowed(L, obj);
 				lua_pushvalue(L, -1);
 				lua_rawseti(L, -4, idx);
 				lua_remove(L, -2);
@@ -821,7 +1511,7 @@ luacs_array__index(lua_State *L)
 		}
 		break;
 	case LUACS_TEXTREF:
-		luacs_usertable(L, 1);
+		luacs_usertable(L, 1, obj->nmemb);
 		lua_rawgeti(L, -1, idx);
 		lua_remove(L, -2);
 		break;
@@ -830,7 +1520,7 @@ luacs_array__index(lua_State *L)
 		if (ptr == NULL)
 			lua_pushnil(L);
 		else {
-			luacs_usertable(L, 1);
+			luacs_usertable(L, 1, obj->nmemb);
 			lua_rawgeti(L, -1, idx);
 			if (lua_isnil(L, -1)) {
 				lua_pop(L, 1);
@@ -840,11 +1530,13 @@ luacs_array__index(lua_State *L)
 				lua_pop(L, 1);
 				if (cat->typref != 0)
 					luacs_getref(L, cat->typref);
-				luacs_newarray0(L, cat->type, cat->typref,
-				    (cat->typref != 0)? -1 : 0, cat->nmemb,
-				    cat->flags, obj->ptr + region.off);
+				luacs_newarray0(L, cat->type,
+				    (cat->typref != 0)? -1 : 0, cat->size,
+				    cat->nmemb, cat->flags,
+				    obj->ptr + region.off);
 				if (cat->typref != 0)
 					lua_remove(L, -2);
+				luacs_nestborrowed(L, obj);
 				lua_pushvalue(L, -1);
 				lua_rawseti(L, -3, idx);
 			}
@@ -865,7 +1557,7 @@ luacs_array__newindex(lua_State *L)
 	struct luacstruct	*cs0;
 
 	lua_settop(L, 3);
-	obj = luaL_checkudata(L, 1, METANAME_LUACARRAY);
+	obj = luacs_checkarray(L, 1, lua_upvalueindex(1));
 	idx = luaL_checkinteger(L, 2);
 	if (idx < 1 || obj->nmemb < idx) { /* out of the range */
 		lua_pushfstring(L, "array index %d out of the range 1:%d",
@@ -877,6 +1569,7 @@ luacs_array__newindex(lua_State *L)
 	region.size = obj->size;
 	region.typref = obj->typref;
 	region.flags = obj->flags;
+	region.acc = obj->acc;
 
 	if ((obj->flags & LUACS_FREADONLY) != 0) {
 readonly:
@@ -898,7 +1591,7 @@ readonly:
 		lua_pop(L, 1);
 		/* given instance of struct */
 		if (region.type == LUACS_TOBJENT || !lua_isnil(L, 3))
-			ano = luaL_checkudata(L, 3, METANAME_LUACSTRUCTOBJ);
+			ano = luacs_checkobj(L, 3);
 		if (ano != NULL && cs0 != ano->cs) {
 			lua_pushfstring(L,
 			    "must be an instance of `struct %s'",
@@ -911,7 +1604,7 @@ readonly:
 			/* ca't assume the object is cached */
 			lua_pushcfunction(L, luacs_array__index);
 			lua_pushvalue(L, 1);
-			lua_pushinteger(L, 2);
+			lua_pushinteger(L, idx);
 			lua_call(L, 2, 1);
 
 			lua_pushvalue(L, 3);
@@ -920,14 +1613,14 @@ readonly:
 			*(void **)(obj->ptr + region.off) = ano? ano->ptr :
 			    NULL;
 			/* use the same object */
-			luacs_usertable(L, 1);
+			luacs_usertable(L, 1, obj->nmemb);
 			lua_pushvalue(L, 3);
 			lua_rawseti(L, -2, idx);
 			lua_pop(L, 1);
 		}
 		break;
 	case LUACS_TEXTREF:
-		luacs_usertable(L, 1);
+		luacs_usertable(L, 1, obj->nmemb);
 		lua_pushvalue(L, 3);
 		lua_rawseti(L, -2, idx);
 		lua_pop(L, 1);
@@ -937,7 +1630,7 @@ readonly:
 
 		lua_pushcfunction(L, luacs_array__index);
 		lua_pushvalue(L, 1);
-		lua_pushinteger(L, 2);
+		lua_pushinteger(L, idx);
 		lua_call(L, 2, 1);
 
 		lua_pushvalue(L, 3);
@@ -969,6 +1662,8 @@ luacs_array_copy(lua_State *L)
 		    "can't copy between arrays which size are different");
 		lua_error(L);
 	}
+	if (luacs_array_copyplain(l, r))
+		return (0);
 	switch (l->type) {
 	default:
 		for (idx = 1; idx <= l->nmemb; idx++) {
@@ -976,6 +1671,8 @@ luacs_array_copy(lua_State *L)
 			region.off = (idx - 1) * l->size;
 			region.size = l->size;
 			region.typref = l->typref;
+			region.flags = l->flags;
+			region.acc = l->acc;
 
 			lua_pushcfunction(L, luacs_array__index);
 			lua_pushvalue(L, 2);
@@ -987,7 +1684,7 @@ luacs_array_copy(lua_State *L)
 		}
 		break;
 	case LUACS_TOBJREF:
-		luacs_usertable(L, 1);
+		luacs_usertable(L, 1, l->nmemb);
 		for (idx = 1; idx <= l->nmemb; idx++) {
 			/* use the same pointer */
 			*(void **)(l->ptr + (idx - 1) * l->size) =
@@ -1020,7 +1717,7 @@ luacs_array_copy(lua_State *L)
 		}
 		break;
 	case LUACS_TEXTREF:
-		luacs_usertable(L, 1);
+		luacs_usertable(L, 1, l->nmemb);
 		for (idx = 1; idx <= l->nmemb; idx++) {
 			lua_pushcfunction(L, luacs_array__index);
 			lua_pushvalue(L, 2);
@@ -1042,7 +1739,7 @@ luacs_array_copy(lua_State *L)
 
 			lua_pushcfunction(L, luacs_array__index);
 			lua_pushvalue(L, 2);
-			lua_pushinteger(L, 2);
+			lua_pushinteger(L, idx);
 			lua_call(L, 2, 1);
 
 			lua_call(L, 2, 0);
@@ -1053,6 +1750,109 @@ luacs_array_copy(lua_State *L)
 	return (0);
 }
 
+static inline uint16_t
+luacs_bswap16(uint16_t v)
+{
+	return ((uint16_t)((v >> 8) | (v << 8)));
+}
+
+static inline uint32_t
+luacs_bswap32(uint32_t v)
+{
+	return ((v >> 24) | ((v >> 8) & 0xff00U) | ((v << 8) & 0xff0000U) |
+	    (v << 24));
+}
+
+static inline uint64_t
+luacs_bswap64(uint64_t v)
+{
+	v = ((v >> 8) & 0x00ff00ff00ff00ffULL) |
+	    ((v & 0x00ff00ff00ff00ffULL) << 8);
+	v = ((v >> 16) & 0x0000ffff0000ffffULL) |
+	    ((v & 0x0000ffff0000ffffULL) << 16);
+	return ((v >> 32) | (v << 32));
+}
+
+/* whether the byte order of the flags differs from the host's */
+static inline bool
+luacs_region_swapped(unsigned flags)
+{
+	return (((flags & LUACS_FENDIANBIG) != 0)? htobe16(1) != 1 :
+	    ((flags & LUACS_FENDIANLITTLE) != 0)? htole16(1) != 1 : false);
+}
+
+/*
+ * Copy the array of the plain data at once, and return false if it can't.
+ * The integers are swapped when the byte orders of the arrays are opposite.
+ */
+bool
+luacs_array_copyplain(struct luacobject *l, struct luacobject *r)
+{
+	size_t	 i, n = l->nmemb;
+
+	if (l->size != r->size)
+		return (false);
+	switch (l->type) {
+	case LUACS_TINT8:
+	case LUACS_TINT16:
+	case LUACS_TINT32:
+	case LUACS_TINT64:
+	case LUACS_TUINT8:
+	case LUACS_TUINT16:
+	case LUACS_TUINT32:
+	case LUACS_TUINT64:
+		break;
+	case LUACS_TBOOL:
+	case LUACS_TSTRING:
+	case LUACS_TWSTRING:
+	case LUACS_TBYTEARRAY:
+		memmove(l->ptr, r->ptr, n * l->size);
+		return (true);
+	default:
+		return (false);
+	}
+
+	if (luacs_region_swapped(l->flags) ==
+	    luacs_region_swapped(r->flags) || l->size == 1) {
+		memmove(l->ptr, r->ptr, n * l->size);
+		return (true);
+	}
+	/* simple loops which the compiler can vectorize */
+	switch (l->size) {
+	case 2:
+		for (i = 0; i < n; i++) {
+			uint16_t	v;
+
+			memcpy(&v, r->ptr + i * 2, 2);
+			v = luacs_bswap16(v);
+			memcpy(l->ptr + i * 2, &v, 2);
+		}
+		break;
+	case 4:
+		for (i = 0; i < n; i++) {
+			uint32_t	v;
+
+			memcpy(&v, r->ptr + i * 4, 4);
+			v = luacs_bswap32(v);
+			memcpy(l->ptr + i * 4, &v, 4);
+		}
+		break;
+	case 8:
+		for (i = 0; i < n; i++) {
+			uint64_t	v;
+
+			memcpy(&v, r->ptr + i * 8, 8);
+			v = luacs_bswap64(v);
+			memcpy(l->ptr + i * 8, &v, 8);
+		}
+		break;
+	default:
+		return (false);
+	}
+
+	return (true);
+}
+
 int
 luacs_array__next(lua_State *L)
 {
@@ -1060,7 +1860,7 @@ luacs_array__next(lua_State *L)
 	int			 idx = 0;
 
 	lua_settop(L, 2);
-	obj = luaL_checkudata(L, 1, METANAME_LUACARRAY);
+	obj = luacs_checkarray(L, 1, lua_upvalueindex(1));
 	if (!lua_isnil(L, 2))
 		idx = luaL_checkinteger(L, 2);
 
@@ -1069,11 +1869,11 @@ luacs_array__next(lua_State *L)
 		lua_pushnil(L);
 		return (1);
 	}
+	/* the same upvalue as __index */
+	lua_settop(L, 1);
 	lua_pushinteger(L, idx);
-	lua_pushcfunction(L, luacs_array__index);
-	lua_pushvalue(L, 1);
-	lua_pushinteger(L, idx);
-	lua_call(L, 2, 1);
+	luacs_array__index(L);
+
 	return (2);
 }
 
@@ -1103,102 +1903,1068 @@ luacs_array__ipairs(lua_State *L)
 	return (3);
 }
 
+/*
+ * Create a table which has the elements of the array.  Nested objects and
+ * arrays are converted to tables as well while the depth is more than 1.
+ */
 int
-luacs_array__gc(lua_State *L)
+luacs_array_totable(lua_State *L)
 {
 	struct luacobject	*obj;
+	struct luacregion	 region;
+	int			 i, depth;
 
-	lua_settop(L, 1);
-	obj = luaL_checkudata(L, 1, METANAME_LUACARRAY);
-	if (obj->typref != 0)
-		luacs_unref(L, obj->typref);
-	luacs_deleteusertable(L, 1);
+	obj = luacs_checkarray(L, 1, lua_upvalueindex(1));
+	depth = luaL_optinteger(L, 2, 1);
+	lua_settop(L, 2);
+	lua_createtable(L, obj->nmemb, 0);
 
-	return (0);
+	memset(&region, 0, sizeof(region));
+	region.type = obj->type;
+	region.size = obj->size;
+	region.typref = obj->typref;
+	region.flags = obj->flags;
+	region.acc = obj->acc;
+	for (i = 1; i <= obj->nmemb; i++) {
+		switch (obj->type) {
+		default:
+			region.off = (i - 1) * obj->size;
+			luacs_pushregion(L, obj, &region);
+			break;
+		case LUACS_TOBJREF:
+		case LUACS_TOBJENT:
+		case LUACS_TEXTREF:
+		case LUACS_TARRAY:
+			lua_pushcfunction(L, luacs_array__index);
+			lua_pushvalue(L, 1);
+			lua_pushinteger(L, i);
+			lua_call(L, 2, 1);
+			if (depth > 1 && !lua_isnil(L, -1)) {
+				if (obj->type == LUACS_TOBJENT)
+					luacs_totable(L, luacs_object_totable,
+					    depth - 1);
+				else if (obj->type == LUACS_TARRAY)
+					luacs_totable(L, luacs_array_totable,
+					    depth - 1);
+			}
+			break;
+		}
+		lua_rawseti(L, 3, i);
+	}
+
+	return (1);
 }
 
-/*
- * Push an object located at the ptr of the C struct named tname.  If the ptr
- * is NULL, push a newly created object.  Notice that the function calculates
- * the object's size automatically by the region of the field located last.
- * If the last field doesn't reach the end of the object, the object might be
- * smaller than expected.
- */
-int
-luacs_newobject(lua_State *L, const char *tname, void *ptr)
+/* Replace the value at the top with the table converted by the func */
+void
+luacs_totable(lua_State *L, lua_CFunction func, int depth)
 {
-	int			 ret;
-	char			 metaname[METANAMELEN];
-
-	snprintf(metaname, sizeof(metaname), "%s%s", METANAME_LUACTYPE, tname);
-	lua_getfield(L, LUA_REGISTRYINDEX, metaname);
-
-	ret = luacs_newobject0(L, ptr);
-	lua_remove(L, -2);
-
-	return (ret);
+	lua_pushcfunction(L, func);
+	lua_insert(L, -2);
+	lua_pushinteger(L, depth);
+	lua_call(L, 2, 1);
 }
 
+/*
+ * arr:slice([i[, j]]) returns the array of the members from i to j, which
+ * shares the memory with the array.  The array is kept by the slice at the
+ * index 0 of its user table.
+ */
 int
-luacs_newobject0(lua_State *L, void *ptr)
+luacs_array_slice(lua_State *L)
 {
 	struct luacobject	*obj;
-	struct luacstruct	*cs;
-	struct luacstruct_field	*field;
-	int			 ret;
-	size_t			 objsiz = 0;
+	lua_Integer		 i, j;
 
-	cs = luacs_checkstruct(L, -1);
-	if (ptr != NULL) {
-		obj = lua_newuserdata(L, sizeof(struct luacobject));
-		obj->ptr = ptr;
-	} else {
-		TAILQ_FOREACH(field, &cs->sorted, queue) {
-			objsiz = MAXIMUM(objsiz, field->region.off +
-			    (field->nmemb == 0? 1 : field->nmemb) *
-			    field->region.size);
-		}
-		obj = lua_newuserdata(L, sizeof(struct luacobject) + objsiz);
-		memset(obj, 0, sizeof(struct luacobject) + objsiz);
-		obj->ptr = (caddr_t)(obj + 1);
+	obj = luacs_checkarray(L, 1, lua_upvalueindex(1));
+	i = luaL_optinteger(L, 2, 1);
+	j = luaL_optinteger(L, 3, obj->nmemb);
+	lua_settop(L, 3);
+	luaL_argcheck(L, 1 <= i && i <= obj->nmemb + 1, 2, "out of range");
+	luaL_argcheck(L, i - 1 <= j && j <= obj->nmemb, 3, "out of range");
+	if (obj->type == LUACS_TEXTREF) {
+		/* the values are not in the memory */
+		lua_pushliteral(L, "can't slice an array of extref");
+		lua_error(L);
 	}
-	obj->cs = cs;
-	lua_pushvalue(L, -2);
-	obj->typref = luacs_ref(L);
-	if ((ret = luaL_newmetatable(L, METANAME_LUACSTRUCTOBJ)) != 0) {
-		lua_pushcfunction(L, luacs_object__index);
-		lua_setfield(L, -2, "__index");
-		lua_pushcfunction(L, luacs_object__newindex);
-		lua_setfield(L, -2, "__newindex");
-		lua_pushcfunction(L, luacs_object__next);
-		lua_pushcclosure(L, luacs_object__pairs, 1);
-		lua_setfield(L, -2, "__pairs");
-		lua_pushcfunction(L, luacs_object__gc);
-		lua_setfield(L, -2, "__gc");
-		lua_pushcfunction(L, luacs_object__tostring);
-		lua_setfield(L, -2, "__tostring");
-		lua_pushcfunction(L, luacs_object__eq);
-		lua_setfield(L, -2, "__eq");
-		lua_pushcfunction(L, luacs_object__luacstructdump);
-		lua_setfield(L, -2, "__luacstructdump");
+	if (obj->type == LUACS_TOBJREF) {
+		/* the referenced objects are kept by the array */
+		lua_pushliteral(L, "can't slice an array of objref");
+		lua_error(L);
 	}
-	lua_setmetatable(L, -2);
+	if ((obj->flags & LUACS_OFINBORROWED) != 0) {
+		/* the slice can't be released with the borrowed object */
+		lua_pushliteral(L, "can't slice an array in a borrowed object");
+		lua_error(L);
+	}
+	if (obj->typref != 0)
+		luacs_getref(L, obj->typref);
+	luacs_newarray0(L, obj->type, (obj->typref != 0)? -1 : 0, obj->size,
+	    j - i + 1, obj->flags & (LUACS_FREADONLY | LUACS_FENDIAN),
+	    obj->ptr + (i - 1) * obj->size);
+	if (obj->typref != 0)
+		lua_remove(L, -2);
+	luacs_usertable(L, -1, j - i + 1);
+	lua_pushvalue(L, 1);
+	lua_rawseti(L, -2, 0);
+	lua_pop(L, 1);
 
 	return (1);
 }
 
+/*
+ * arr:fromtable(tbl) assigns the values of the sequence of the table to
+ * the members from the first.  The members are restored if assigning a
+ * value fails.
+ */
 int
-luacs_object__luacstructdump(struct lua_State *L)
+luacs_array_fromtable(lua_State *L)
 {
 	struct luacobject	*obj;
+	struct luacstruct	*cs0;
+	struct luacregion	 region;
+	int			 i, n;
+	caddr_t			 saved;
+	char			 buf[BUFSIZ];
 
-	lua_settop(L, 1);
-	obj = luaL_checkudata(L, 1, METANAME_LUACSTRUCTOBJ);
-	lua_pushlightuserdata(L, obj->ptr);
-	lua_pushstring(L, obj->cs->typename);
+	obj = luacs_checkarray(L, 1, lua_upvalueindex(1));
+	luaL_checktype(L, 2, LUA_TTABLE);
+	lua_settop(L, 2);
+	n = lua_rawlen(L, 2);
+	if ((obj->flags & LUACS_FREADONLY) != 0 ||
+	    obj->type == LUACS_TSTRPTR || obj->type == LUACS_TWSTRPTR) {
+		lua_pushliteral(L, "array is readonly");
+		lua_error(L);
+	}
+	if (n > obj->nmemb)
+		luaL_error(L, "%d values for the array of %d members", n,
+		    obj->nmemb);
 
-	return (2);
-}
+	memset(&region, 0, sizeof(region));
+	region.type = obj->type;
+	region.size = obj->size;
+	region.typref = obj->typref;
+	region.flags = obj->flags;
+	region.acc = obj->acc;
+	switch (obj->type) {
+	case LUACS_TINT8:
+	case LUACS_TINT16:
+	case LUACS_TINT32:
+	case LUACS_TINT64:
+	case LUACS_TUINT8:
+	case LUACS_TUINT16:
+	case LUACS_TUINT32:
+	case LUACS_TUINT64:
+	case LUACS_TBOOL:
+		/* assigning these never fails */
+		for (i = 1; i <= n; i++) {
+			region.off = (i - 1) * obj->size;
+			lua_rawgeti(L, 2, i);
+			luacs_pullregion(L, obj, &region, -1);
+			lua_pop(L, 1);
+		}
+		return (0);
+	case LUACS_TEXTREF:
+		luacs_usertable(L, 1, obj->nmemb);
+		for (i = 1; i <= n; i++) {
+			lua_rawgeti(L, 2, i);
+			lua_rawseti(L, -2, i);
+		}
+		return (0);
+	case LUACS_TOBJREF:
+	case LUACS_TOBJENT:
+		/* the objects are cached, check them before assigning */
+		luacs_getref(L, obj->typref);
+		cs0 = luacs_checkstruct(L, -1);
+		lua_pop(L, 1);
+		for (i = 1; i <= n; i++) {
+			lua_rawgeti(L, 2, i);
+			if ((obj->type == LUACS_TOBJENT || !lua_isnil(L, -1)) &&
+			    luacs_checkobj(L, -1)->cs != cs0)
+				luaL_error(L, "must be an instance of "
+				    "`struct %s'", cs0->typename);
+			lua_pop(L, 1);
+		}
+		break;
+	default:
+		break;
+	}
+
+	/* save the members to restore them on an error */
+	if ((saved = malloc(obj->nmemb * obj->size + 1)) == NULL) {
+		strerror_r(errno, buf, sizeof(buf));
+		lua_pushstring(L, buf);
+		lua_error(L);
+	}
+	memcpy(saved, obj->ptr, obj->nmemb * obj->size);
+	lua_pushcfunction(L, luacs_array_fromtable0);
+	lua_pushvalue(L, 1);
+	lua_pushvalue(L, 2);
+	if (lua_pcall(L, 2, 0, 0) != 0) {
+		memcpy(obj->ptr, saved, obj->nmemb * obj->size);
+		free(saved);
+		lua_error(L);
+	}
+	free(saved);
+
+	return (0);
+}
+
+int
+luacs_array_fromtable0(lua_State *L)
+{
+	int	 i, n;
+
+	n = lua_rawlen(L, 2);
+	for (i = 1; i <= n; i++) {
+		lua_pushcfunction(L, luacs_array__newindex);
+		lua_pushvalue(L, 1);
+		lua_pushinteger(L, i);
+		lua_rawgeti(L, 2, i);
+		lua_call(L, 3, 0);
+	}
+
+	return (0);
+}
+
+/*
+ * The kernels for the integer arrays.  They are written as simple loops
+ * over the members, so that the compiler can vectorize them for the target
+ * instead of having the SIMD intrinsics of each architecture here.  The
+ * loop for the members in the opposite byte order is separated not to check
+ * it for each member.
+ */
+#define LUACS_ARRAY_LOAD(_ut, _i)					\
+	(memcpy(&u, (const char *)ptr + (_i) * sizeof(_ut),		\
+	    sizeof(_ut)), u)
+#define LUACS_ARRAY_MINMAX(_t, _ut, _op, _bswap)			\
+	do {								\
+		for (i = 1; i < n; i++) {				\
+			v = (_t)_bswap(LUACS_ARRAY_LOAD(_ut, i));	\
+			r = (v _op r)? v : r;				\
+		}							\
+	} while (0/*CONSTCOND*/)
+#define LUACS_ARRAY_REDUCER(_name, _t, _ut, _bswap)			\
+static lua_Integer							\
+luacs_array_reduce_##_name(const void *ptr, int n, bool swap, int op)	\
+{									\
+	uint64_t	 sum = 0;					\
+	_ut		 u;						\
+	_t		 r, v;						\
+	int		 i;						\
+									\
+	if (op == LUACS_AOPSUM) {					\
+		if (swap)						\
+			for (i = 0; i < n; i++)				\
+				sum += (uint64_t)(int64_t)(_t)		\
+				    _bswap(LUACS_ARRAY_LOAD(_ut, i));	\
+		else							\
+			for (i = 0; i < n; i++)				\
+				sum += (uint64_t)(int64_t)(_t)		\
+				    LUACS_ARRAY_LOAD(_ut, i);		\
+		return ((lua_Integer)sum);				\
+	}								\
+	r = (_t)LUACS_ARRAY_LOAD(_ut, 0);				\
+	if (swap) {							\
+		r = (_t)_bswap((_ut)r);					\
+		if (op == LUACS_AOPMIN)					\
+			LUACS_ARRAY_MINMAX(_t, _ut, <, _bswap);		\
+		else							\
+			LUACS_ARRAY_MINMAX(_t, _ut, >, _bswap);		\
+	} else if (op == LUACS_AOPMIN)					\
+		LUACS_ARRAY_MINMAX(_t, _ut, <, );			\
+	else								\
+		LUACS_ARRAY_MINMAX(_t, _ut, >, );			\
+	return ((lua_Integer)r);					\
+}
+#define luacs_bswap8(_v)	(_v)
+LUACS_ARRAY_REDUCER(i8,  int8_t,   uint8_t,  luacs_bswap8)
+LUACS_ARRAY_REDUCER(i16, int16_t,  uint16_t, luacs_bswap16)
+LUACS_ARRAY_REDUCER(i32, int32_t,  uint32_t, luacs_bswap32)
+LUACS_ARRAY_REDUCER(i64, int64_t,  uint64_t, luacs_bswap64)
+LUACS_ARRAY_REDUCER(u8,  uint8_t,  uint8_t,  luacs_bswap8)
+LUACS_ARRAY_REDUCER(u16, uint16_t, uint16_t, luacs_bswap16)
+LUACS_ARRAY_REDUCER(u32, uint32_t, uint32_t, luacs_bswap32)
+LUACS_ARRAY_REDUCER(u64, uint64_t, uint64_t, luacs_bswap64)
+
+static lua_Integer (*const luacs_array_reducers[])(const void *, int, bool,
+    int) = {
+	luacs_array_reduce_i8, luacs_array_reduce_i16,
+	luacs_array_reduce_i32, luacs_array_reduce_i64,
+	luacs_array_reduce_u8, luacs_array_reduce_u16,
+	luacs_array_reduce_u32, luacs_array_reduce_u64
+};
+
+/*
+ * Return the first index of the members equal to the key from `init', or
+ * the number of them if `count' is true.  The key is in the byte order of
+ * the members, so they are compared as they are.
+ */
+#define LUACS_ARRAY_FINDER(_name, _ut)					\
+static int								\
+luacs_array_find_##_name(const void *ptr, int n, uint64_t key, int init,\
+    bool count)								\
+{									\
+	_ut		 u, k = (_ut)key;				\
+	int		 i, cnt = 0;					\
+									\
+	if (count) {							\
+		for (i = 0; i < n; i++)					\
+			cnt += (LUACS_ARRAY_LOAD(_ut, i) == k);		\
+		return (cnt);						\
+	}								\
+	for (i = init; i < n; i++)					\
+		if (LUACS_ARRAY_LOAD(_ut, i) == k)			\
+			return (i + 1);					\
+	return (0);							\
+}
+LUACS_ARRAY_FINDER(8,  uint8_t)
+LUACS_ARRAY_FINDER(16, uint16_t)
+LUACS_ARRAY_FINDER(32, uint32_t)
+LUACS_ARRAY_FINDER(64, uint64_t)
+
+/*
+ * Check the array at the 1st argument is of integers whose size is the
+ * same as the type, so that the kernels can take the memory as a vector.
+ * The members may be unaligned in a packed struct, the kernels load them
+ * by memcpy().
+ */
+struct luacobject *
+luacs_checkintarray(lua_State *L, const char *method)
+{
+	struct luacobject	*obj;
+	static const size_t	 sizes[] = { 1, 2, 4, 8, 1, 2, 4, 8 };
+
+	obj = luacs_checkarray(L, 1, lua_upvalueindex(1));
+	if (obj->type < LUACS_TINT8 || LUACS_TUINT64 < obj->type ||
+	    obj->size != sizes[obj->type - LUACS_TINT8])
+		luaL_error(L, "`%s' is only for an array of integers", method);
+
+	return (obj);
+}
+
+/*
+ * arr:sum(), arr:min() and arr:max() of an integer array.  The sum wraps
+ * around on the overflow, min and max of the empty array are nil.
+ */
+int
+luacs_array_reduce(lua_State *L)
+{
+	struct luacobject	*obj;
+	int			 op;
+
+	op = lua_tointeger(L, lua_upvalueindex(2));
+	obj = luacs_checkintarray(L, (op == LUACS_AOPSUM)? "sum" :
+	    (op == LUACS_AOPMIN)? "min" : "max");
+	if (op != LUACS_AOPSUM && obj->nmemb == 0)
+		lua_pushnil(L);
+	else
+		lua_pushinteger(L, luacs_array_reducers[obj->type -
+		    LUACS_TINT8](obj->ptr, obj->nmemb,
+		    luacs_region_swapped(obj->flags), op));
+
+	return (1);
+}
+
+/*
+ * arr:fill(v) assigns the value to all members.  The first member is
+ * assigned as usual, then it is copied to the others.
+ */
+int
+luacs_array_fill(lua_State *L)
+{
+	struct luacobject	*obj;
+	struct luacregion	 region;
+	size_t			 done, total;
+
+	obj = luacs_checkarray(L, 1, lua_upvalueindex(1));
+	lua_settop(L, 2);
+	switch (obj->type) {
+	case LUACS_TINT8:
+	case LUACS_TINT16:
+	case LUACS_TINT32:
+	case LUACS_TINT64:
+	case LUACS_TUINT8:
+	case LUACS_TUINT16:
+	case LUACS_TUINT32:
+	case LUACS_TUINT64:
+	case LUACS_TENUM:
+	case LUACS_TBOOL:
+	case LUACS_TSTRING:
+	case LUACS_TWSTRING:
+	case LUACS_TBYTEARRAY:
+		break;
+	default:
+		luaL_error(L, "`fill' is only for an array of values");
+	}
+	if ((obj->flags & LUACS_FREADONLY) != 0) {
+		lua_pushliteral(L, "array is readonly");
+		lua_error(L);
+	}
+	if (obj->nmemb == 0)
+		return (0);
+
+	memset(&region, 0, sizeof(region));
+	region.type = obj->type;
+	region.size = obj->size;
+	region.typref = obj->typref;
+	region.flags = obj->flags;
+	region.acc = obj->acc;
+	luacs_pullregion(L, obj, &region, 2);
+	total = obj->nmemb * obj->size;
+	for (done = obj->size; done < total; done *= 2)
+		memcpy(obj->ptr + done, obj->ptr, MINIMUM(done, total - done));
+
+	return (0);
+}
+
+/*
+ * arr:find(v[, init]) returns the first index of the member equal to the
+ * value from init, or nil.  arr:count(v) returns the number of them.
+ */
+int
+luacs_array_find(lua_State *L)
+{
+	struct luacobject	*obj;
+	lua_Integer		 init = 1;
+	int64_t			 v;
+	uint64_t		 key;
+	bool			 count;
+	int			 ret = 0;
+
+	count = lua_toboolean(L, lua_upvalueindex(2));
+	obj = luacs_checkintarray(L, (count)? "count" : "find");
+	v = luaL_checkinteger(L, 2);
+	if (!count)
+		init = luaL_optinteger(L, 3, 1);
+	luaL_argcheck(L, 1 <= init, 3, "out of range");
+
+	/* the value out of the range of the type is never found */
+	if (!luacs_intinrange(obj->type, obj->size, v))
+		goto notfound;
+	key = (uint64_t)v;
+	if (luacs_region_swapped(obj->flags)) {
+		switch (obj->size) {
+		case 2:	key = luacs_bswap16(key);	break;
+		case 4:	key = luacs_bswap32(key);	break;
+		case 8:	key = luacs_bswap64(key);	break;
+		}
+	}
+	if (init <= obj->nmemb) {
+		switch (obj->size) {
+		case 1:
+			ret = luacs_array_find_8(obj->ptr, obj->nmemb, key,
+			    init - 1, count);
+			break;
+		case 2:
+			ret = luacs_array_find_16(obj->ptr, obj->nmemb, key,
+			    init - 1, count);
+			break;
+		case 4:
+			ret = luacs_array_find_32(obj->ptr, obj->nmemb, key,
+			    init - 1, count);
+			break;
+		case 8:
+			ret = luacs_array_find_64(obj->ptr, obj->nmemb, key,
+			    init - 1, count);
+			break;
+		}
+	}
+notfound:
+	if (count)
+		lua_pushinteger(L, ret);
+	else if (ret == 0)
+		lua_pushnil(L);
+	else
+		lua_pushinteger(L, ret);
+
+	return (1);
+}
+
+/* whether the value is in the range of the integer type of the size */
+bool
+luacs_intinrange(enum luacstruct_type _type, size_t size, int64_t v)
+{
+	int	 bits = size * 8;
+
+	if (bits >= 64)
+		return (true);
+	if (_type <= LUACS_TINT64)
+		return (-((int64_t)1 << (bits - 1)) <= v &&
+		    v < ((int64_t)1 << (bits - 1)));
+	return (0 <= v && v < ((int64_t)1 << bits));
+}
+
+/*
+ * Load the integer as the key which is ordered as unsigned, by flipping
+ * the sign bit of the signed integers.
+ */
+uint64_t
+luacs_loadintkey(const void *ptr, enum luacstruct_type _type, bool swap)
+{
+	uint8_t		 u8;
+	uint16_t	 u16;
+	uint32_t	 u32;
+	uint64_t	 u64;
+
+	switch (_type) {
+	case LUACS_TINT8:
+	case LUACS_TUINT8:
+		memcpy(&u8, ptr, sizeof(u8));
+		return ((_type == LUACS_TINT8)?
+		    (uint64_t)(int64_t)(int8_t)u8 ^ LUACS_KEYSIGNBIT : u8);
+	case LUACS_TINT16:
+	case LUACS_TUINT16:
+		memcpy(&u16, ptr, sizeof(u16));
+		if (swap)
+			u16 = luacs_bswap16(u16);
+		return ((_type == LUACS_TINT16)?
+		    (uint64_t)(int64_t)(int16_t)u16 ^ LUACS_KEYSIGNBIT : u16);
+	case LUACS_TINT32:
+	case LUACS_TUINT32:
+		memcpy(&u32, ptr, sizeof(u32));
+		if (swap)
+			u32 = luacs_bswap32(u32);
+		return ((_type == LUACS_TINT32)?
+		    (uint64_t)(int64_t)(int32_t)u32 ^ LUACS_KEYSIGNBIT : u32);
+	default:
+		memcpy(&u64, ptr, sizeof(u64));
+		if (swap)
+			u64 = luacs_bswap64(u64);
+		return ((_type == LUACS_TINT64)? u64 ^ LUACS_KEYSIGNBIT : u64);
+	}
+}
+
+/*
+ * The integer type to load the value of the type as the key.  Enums are
+ * loaded as the signed integers of the size, booleans as 0 or 1.  Returns
+ * -1 if the value cannot be a key.
+ */
+int
+luacs_sortkeytype(enum luacstruct_type _type, size_t size)
+{
+	static const size_t	 sizes[] = { 1, 2, 4, 8, 1, 2, 4, 8 };
+
+	switch (_type) {
+	case LUACS_TINT8:
+	case LUACS_TINT16:
+	case LUACS_TINT32:
+	case LUACS_TINT64:
+	case LUACS_TUINT8:
+	case LUACS_TUINT16:
+	case LUACS_TUINT32:
+	case LUACS_TUINT64:
+		return ((size == sizes[_type - LUACS_TINT8])? (int)_type : -1);
+	case LUACS_TENUM:
+	case LUACS_TBOOL:
+		switch (size) {
+		case 1:	return ((_type == LUACS_TENUM)?
+			    LUACS_TINT8 : LUACS_TUINT8);
+		case 2:	return ((_type == LUACS_TENUM)?
+			    LUACS_TINT16 : LUACS_TUINT16);
+		case 4:	return ((_type == LUACS_TENUM)?
+			    LUACS_TINT32 : LUACS_TUINT32);
+		case 8:	return ((_type == LUACS_TENUM)?
+			    LUACS_TINT64 : LUACS_TUINT64);
+		}
+		break;
+	default:
+		break;
+	}
+
+	return (-1);
+}
+
+struct luacs_sortkey {
+	uint64_t	 key;
+	int		 idx;
+};
+
+/* arr:sort([desc]) sorts the array of integers, enums or booleans in place */
+int
+luacs_array_sort(lua_State *L)
+{
+	struct luacobject	*obj;
+	int			 keytype;
+
+	obj = luacs_checkarray(L, 1, lua_upvalueindex(1));
+	if ((keytype = luacs_sortkeytype(obj->type, obj->size)) < 0)
+		luaL_error(L, "`sort' is only for an array of integers, "
+		    "enums or booleans");
+	/* enums and booleans are always in the byte order of the host */
+	luacs_array_sort0(L, obj, 0, keytype, obj->type <= LUACS_TUINT64 &&
+	    luacs_region_swapped(obj->flags), lua_toboolean(L, 2));
+
+	return (0);
+}
+
+/*
+ * arr:sort_by(name[, desc]) sorts the array of nested structs in place by
+ * the integer, enum or boolean field of the name.
+ */
+int
+luacs_array_sort_by(lua_State *L)
+{
+	struct luacobject	*obj;
+	struct luacstruct	*cs;
+	struct luacstruct_field	*field;
+	const char		*name;
+	int			 keytype;
+
+	obj = luacs_checkarray(L, 1, lua_upvalueindex(1));
+	name = luaL_checkstring(L, 2);
+	if (obj->type != LUACS_TOBJENT)
+		luaL_error(L, "`sort_by' is only for an array of nested "
+		    "structs");
+	luacs_getref(L, obj->typref);
+	cs = luacs_checkstruct(L, -1);
+	lua_pop(L, 1);
+	if ((field = luacs_findfield(cs, name)) == NULL)
+		luaL_error(L, "`struct %s' doesn't have field `%s'",
+		    cs->typename, name);
+	if ((keytype = luacs_sortkeytype(field->type,
+	    field->region.size)) < 0)
+		luaL_error(L, "field `%s' is not an integer, an enum or a "
+		    "boolean", name);
+	luacs_array_sort0(L, obj, field->region.off, keytype,
+	    field->type <= LUACS_TUINT64 &&
+	    luacs_region_swapped(field->flags), lua_toboolean(L, 3));
+
+	return (0);
+}
+
+/*
+ * Sort the members by the integer at the offset of each member.  The keys
+ * and the indices are sorted first, then the members are moved at once.
+ * The indices make the sort stable.
+ */
+void
+luacs_array_sort0(lua_State *L, struct luacobject *obj, int off,
+    enum luacstruct_type _type, bool swap, bool desc)
+{
+	struct luacs_sortkey	*keys;
+	caddr_t			 tmp;
+	int			 i, n = obj->nmemb;
+	char			 buf[BUFSIZ];
+
+	if ((obj->flags & LUACS_FREADONLY) != 0) {
+		lua_pushliteral(L, "array is readonly");
+		lua_error(L);
+	}
+	if (n <= 1)
+		return;
+	if ((keys = calloc(n, sizeof(struct luacs_sortkey))) == NULL ||
+	    (tmp = malloc(n * obj->size)) == NULL) {
+		free(keys);
+		strerror_r(errno, buf, sizeof(buf));
+		lua_pushstring(L, buf);
+		lua_error(L);
+	}
+	for (i = 0; i < n; i++) {
+		keys[i].key = luacs_loadintkey(obj->ptr + i * obj->size + off,
+		    _type, swap);
+		keys[i].idx = i;
+	}
+	qsort(keys, n, sizeof(struct luacs_sortkey), (desc)?
+	    luacs_sortkey_rcmp : luacs_sortkey_cmp);
+	for (i = 0; i < n; i++)
+		memcpy(tmp + i * obj->size, obj->ptr + keys[i].idx *
+		    obj->size, obj->size);
+	memcpy(obj->ptr, tmp, n * obj->size);
+	free(tmp);
+	free(keys);
+}
+
+int
+luacs_sortkey_cmp(const void *a0, const void *b0)
+{
+	const struct luacs_sortkey	*a = a0, *b = b0;
+
+	if (a->key != b->key)
+		return ((a->key < b->key)? -1 : 1);
+	return (a->idx - b->idx);
+}
+
+int
+luacs_sortkey_rcmp(const void *a0, const void *b0)
+{
+	const struct luacs_sortkey	*a = a0, *b = b0;
+
+	if (a->key != b->key)
+		return ((a->key > b->key)? -1 : 1);
+	return (a->idx - b->idx);
+}
+
+/*
+ * arr:bsearch(v) returns the first index of the member equal to the value
+ * in the array of integers, enums or booleans sorted in the ascending
+ * order, or nil.  The value for an enum array is an integer or a value of
+ * the enum.
+ */
+int
+luacs_array_bsearch(lua_State *L)
+{
+	struct luacobject	*obj;
+	struct luacenum_value	*val;
+	int64_t			 v;
+	uint64_t		 key;
+	bool			 swap;
+	int			 lo, hi, mid, keytype;
+
+	obj = luacs_checkarray(L, 1, lua_upvalueindex(1));
+	if ((keytype = luacs_sortkeytype(obj->type, obj->size)) < 0)
+		luaL_error(L, "`bsearch' is only for an array of integers, "
+		    "enums or booleans");
+	if (obj->type == LUACS_TBOOL && lua_type(L, 2) == LUA_TBOOLEAN)
+		v = lua_toboolean(L, 2);
+	else if (obj->type == LUACS_TENUM &&
+	    lua_type(L, 2) == LUA_TUSERDATA) {
+		val = luaL_checkudata(L, 2, METANAME_LUACSENUMVAL);
+		v = val->value;
+	} else
+		v = luaL_checkinteger(L, 2);
+	if (!luacs_intinrange(keytype, obj->size, v)) {
+		lua_pushnil(L);
+		return (1);
+	}
+	key = (keytype <= LUACS_TINT64)? (uint64_t)v ^ LUACS_KEYSIGNBIT :
+	    (uint64_t)v;
+	swap = obj->type <= LUACS_TUINT64 && luacs_region_swapped(obj->flags);
+	/* the lower bound */
+	lo = 0;
+	hi = obj->nmemb;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (luacs_loadintkey(obj->ptr + mid * obj->size, keytype,
+		    swap) < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < obj->nmemb && luacs_loadintkey(obj->ptr + lo * obj->size,
+	    keytype, swap) == key)
+		lua_pushinteger(L, lo + 1);
+	else
+		lua_pushnil(L);
+
+	return (1);
+}
+
+int
+luacs_array__gc(lua_State *L)
+{
+	struct luacobject	*obj;
+
+	lua_settop(L, 1);
+	/* an array released with a borrowed object is also collected */
+	obj = luaL_checkudata(L, 1, METANAME_LUACARRAY);
+	if (obj->typref != 0)
+		luacs_unref(L, obj->typref);
+
+	return (0);
+}
+
+/*
+ * Push an object located at the ptr of the C struct named tname.  If the ptr
+ * is NULL, push a newly created object.  Notice that the function calculates
+ * the object's size automatically by the region of the field located last.
+ * If the last field doesn't reach the end of the object, the object might be
+ * smaller than expected.
+ */
+int
+luacs_newobject(lua_State *L, const char *tname, void *ptr)
+{
+	int			 ret;
+	char			 metaname[METANAMELEN];
+
+	snprintf(metaname, sizeof(metaname), "%s%s", METANAME_LUACTYPE, tname);
+	lua_getfield(L, LUA_REGISTRYINDEX, metaname);
+
+	ret = luacs_newobject0(L, ptr);
+	lua_remove(L, -2);
+
+	return (ret);
+}
+
+/* Same as luacs_newobject(), but the struct is specified by the handle */
+int
+luacs_newobject_h(lua_State *L, luacs_typehandle_t cs, void *ptr)
+{
+	luacs_getref(L, cs->metaref);
+
+	return (luacs_newobject1(L, cs, ptr, 0));
+}
+
+int
+luacs_newobject0(lua_State *L, void *ptr)
+{
+	struct luacstruct	*cs;
+
+	cs = luacs_checkstruct(L, -1);
+	lua_getuservalue(L, -1);
+
+	return (luacs_newobject1(L, cs, ptr, 0));
+}
+
+/*
+ * Create an object of the struct, whose metatable is on the top of the
+ * stack.  The metatable is replaced by the object.  If the struct keeps the
+ * identities, the existing object for the pointer is used instead.
+ */
+int
+luacs_newobject1(lua_State *L, struct luacstruct *cs, void *ptr,
+    unsigned flags)
+{
+	struct luacobject	*obj;
+	int			 mtidx, identidx = 0;
+
+	mtidx = lua_gettop(L);
+	if (ptr != NULL && cs->identref != 0) {
+		luacs_getref(L, cs->identref);
+		identidx = lua_gettop(L);
+		lua_pushlightuserdata(L, ptr);
+		lua_rawget(L, identidx);
+		if (!lua_isnil(L, -1)) {
+			lua_replace(L, mtidx);
+			lua_settop(L, mtidx);
+			return (1);
+		}
+		lua_pop(L, 1);
+	}
+	if (ptr != NULL || (flags & LUACS_OFBORROWED) != 0) {
+		obj = lua_newuserdata(L, sizeof(struct luacobject));
+		obj->ptr = ptr;
+	} else {
+		obj = lua_newuserdata(L, sizeof(struct luacobject) + cs->size);
+		memset(obj, 0, sizeof(struct luacobject) + cs->size);
+		obj->ptr = (caddr_t)(obj + 1);
+	}
+	obj->cs = cs;
+	obj->typref = 0;	/* the metatable keeps the struct */
+	obj->flags = flags;
+	lua_pushvalue(L, mtidx);
+	lua_setmetatable(L, -2);
+	if (identidx != 0) {
+		lua_pushlightuserdata(L, ptr);
+		lua_pushvalue(L, -2);
+		lua_rawset(L, identidx);
+	}
+	lua_replace(L, mtidx);
+	lua_settop(L, mtidx);
+
+	return (1);
+}
+
+/*
+ * Check whether the value at the idx is an object of any struct.  The
+ * metatables of the objects are created per a struct, but all of them have
+ * the same __luacstructdump.  A borrowed object may not be bound.
+ */
+struct luacobject *
+luacs_checkobj0(lua_State *L, int idx)
+{
+	struct luacobject	*obj;
+
+	if ((obj = lua_touserdata(L, idx)) != NULL &&
+	    lua_getmetatable(L, idx)) {
+		lua_pushliteral(L, "__luacstructdump");
+		lua_rawget(L, -2);
+		if (lua_tocfunction(L, -1) == luacs_object__luacstructdump) {
+			lua_pop(L, 2);
+			return (obj);
+		}
+		lua_pop(L, 2);
+	}
+	lua_pushfstring(L, "%s expected, got %s", METANAME_LUACSTRUCTOBJ,
+	    luaL_typename(L, idx));
+	luaL_argerror(L, idx, lua_tostring(L, -1));
+	/* NOTREACHED */
+	abort();
+}
+
+/* Same as luacs_checkobj0(), but the object must be bound to a struct */
+struct luacobject *
+luacs_checkobj(lua_State *L, int idx)
+{
+	struct luacobject	*obj;
+
+	obj = luacs_checkobj0(L, idx);
+	if (obj->ptr == NULL)
+		luaL_error(L, "the borrowed object of `struct %s' is used "
+		    "after released", obj->cs->typename);
+
+	return (obj);
+}
+
+/*
+ * Check the object by comparing its metatable with the one at mtidx, which
+ * must be a pseudo index of an upvalue.  Fall back to luacs_checkobj() since
+ * the metamethods may be called for an object of another struct.
+ */
+struct luacobject *
+luacs_checkobj_mt(lua_State *L, int idx, int mtidx)
+{
+	struct luacobject	*obj;
+
+	if ((obj = lua_touserdata(L, idx)) != NULL &&
+	    lua_getmetatable(L, idx)) {
+		if (lua_rawequal(L, -1, mtidx) && obj->ptr != NULL) {
+			lua_pop(L, 1);
+			return (obj);
+		}
+		lua_pop(L, 1);
+	}
+
+	return (luacs_checkobj(L, idx));
+}
+
+/* Same as luacs_checkobj_mt(), but for an array */
+struct luacobject *
+luacs_checkarray(lua_State *L, int idx, int mtidx)
+{
+	struct luacobject	*obj;
+
+	if ((obj = lua_touserdata(L, idx)) != NULL &&
+	    lua_getmetatable(L, idx)) {
+		if (lua_rawequal(L, -1, mtidx) && obj->ptr != NULL) {
+			lua_pop(L, 1);
+			return (obj);
+		}
+		lua_pop(L, 1);
+	}
+	obj = luaL_checkudata(L, idx, METANAME_LUACARRAY);
+	if (obj->ptr == NULL)
+		luaL_error(L, "the array in a borrowed object is used after "
+		    "released");
+
+	return (obj);
+}
+
+/*
+ * Mark the object or the array at the top, which is nested in obj, as
+ * nested in a borrowed object if obj is, so that it is released together.
+ */
+void
+luacs_nestborrowed(lua_State *L, struct luacobject *obj)
+{
+	struct luacobject	*nested;
+
+	if ((obj->flags & (LUACS_OFBORROWED | LUACS_OFINBORROWED)) != 0) {
+		nested = lua_touserdata(L, -1);
+		nested->flags |= LUACS_OFINBORROWED;
+	}
+}
+
+/*
+ * Release the objects for the nested structs and arrays cached in the user
+ * table of the object or the array at idx, since they point to the memory
+ * of the instance which the borrowed object is bound to.
+ */
+void
+luacs_releasenested(lua_State *L, int idx, bool isarray)
+{
+	struct luacobject	*obj;
+	struct luacstruct_field	*field;
+	int			 i;
+
+	obj = lua_touserdata(L, idx);
+	if ((obj->flags & LUACS_OFUSERTABLE) == 0)
+		return;
+	lua_getuservalue(L, idx);
+	if (!isarray) {
+		TAILQ_FOREACH(field, &obj->cs->sorted, queue) {
+			if (field->type == LUACS_TOBJENT ||
+			    field->type == LUACS_TARRAY)
+				luacs_releasenested0(L, field->slot,
+				    field->type == LUACS_TARRAY);
+		}
+	} else if (obj->type == LUACS_TOBJENT || obj->type == LUACS_TARRAY) {
+		for (i = 1; i <= obj->nmemb; i++)
+			luacs_releasenested0(L, i,
+			    obj->type == LUACS_TARRAY);
+	}
+	lua_pop(L, 1);
+}
+
+/* Release the nested object at the index of the user table at the top */
+void
+luacs_releasenested0(lua_State *L, int i, bool isarray)
+{
+	struct luacobject	*nested;
+
+	lua_rawgeti(L, -1, i);
+	if ((nested = lua_touserdata(L, -1)) != NULL &&
+	    (nested->flags & LUACS_OFINBORROWED) != 0) {
+		luacs_releasenested(L, lua_gettop(L), isarray);
+		nested->ptr = NULL;
+	}
+	lua_pop(L, 1);
+}
+
+int
+luacs_object__luacstructdump(struct lua_State *L)
+{
+	struct luacobject	*obj;
+
+	lua_settop(L, 1);
+	obj = luacs_checkobj0(L, 1);
+	lua_pushlightuserdata(L, obj->ptr);
+	lua_pushstring(L, obj->cs->typename);
+
+	return (2);
+}
+
+/*
+ * Create an object of the struct which isn't bound to any instance.  It is
+ * bound by luacs_object_bind() repeatedly, so that the same object is used
+ * for the callbacks without allocating a new one each time.
+ */
+int
+luacs_newborrowed(lua_State *L, const char *tname)
+{
+	char			 metaname[METANAMELEN];
+	struct luacstruct	*cs;
+
+	snprintf(metaname, sizeof(metaname), "%s%s", METANAME_LUACTYPE, tname);
+	lua_getfield(L, LUA_REGISTRYINDEX, metaname);
+	cs = luacs_checkstruct(L, -1);
+	lua_getuservalue(L, -1);
+	luacs_newobject1(L, cs, NULL, LUACS_OFBORROWED);
+	lua_remove(L, -2);
+
+	return (1);
+}
+
+/*
+ * Bind the borrowed object at the idx to the instance at ptr.  Pass NULL to
+ * release the object, then the use of the object raises an error until it
+ * is bound again.  The values cached for the previous instance are cleared,
+ * and the objects for the nested structs and arrays taken from it are
+ * released.
+ */
+void
+luacs_object_bind(lua_State *L, int idx, void *ptr)
+{
+	struct luacobject	*obj;
+
+	idx = lua_absindex(L, idx);
+	obj = luacs_checkobj0(L, idx);
+	if ((obj->flags & LUACS_OFBORROWED) == 0)
+		luaL_error(L, "`struct %s' object is not borrowed",
+		    obj->cs->typename);
+	luacs_releasenested(L, idx, false);
+	obj->ptr = ptr;
+	if ((obj->flags & LUACS_OFUSERTABLE) != 0) {
+		/* drop the user table not to keep the values cached */
+#if LUA_VERSION_NUM == 501
+		lua_newtable(L);
+#else
+		lua_pushnil(L);
+#endif
+		lua_setuservalue(L, idx);
+		obj->flags &= ~LUACS_OFUSERTABLE;
+	}
+}
 
 struct luacobj_compat {
 	void		*ptr;
@@ -1220,25 +2986,161 @@ luacs_object_pointer(lua_State *L, int ref, const char *typename)
 }
 
 /*
- * Explicitly clear the weak reference from the internal user table.  In Lua
- * 5.2 and later, no need to use this function since the reference is
- * automatically calculated.  However, it doesn't work in Lua 5.1 when the
- * pseudo value references the parent object.  To avoid this problem,
- * call this function when the object is no longer needed.
+ * Explicitly clear the values in the user table of the object.  The user
+ * table is the uservalue of the object, so a pseudo value referencing the
+ * parent object doesn't keep it alive even in Lua 5.1.  This function is
+ * left to release the values before the object is collected.
  */
 void
 luacs_object_clear(lua_State *L, int idx)
 {
-	int	 absidx;
+	struct luacobject	*obj;
+	int			 absidx;
 
 	absidx = lua_absindex(L, idx);
-	lua_getfield(L, LUA_REGISTRYINDEX, METANAME_LUACSUSERTABLE);
-	if (!lua_isnil(L, -1)) {
-		lua_pushvalue(L, absidx);
-		lua_newtable(L);
-		lua_settable(L, -3);
+	obj = lua_touserdata(L, absidx);
+	if (obj != NULL && (obj->flags & LUACS_OFUSERTABLE) != 0) {
+		/* the nested objects are no longer tracked */
+		if ((obj->flags & (LUACS_OFBORROWED | LUACS_OFINBORROWED)) != 0)
+			luacs_releasenested(L, absidx, false);
+		lua_createtable(L, obj->cs->nslots, 0);
+		lua_setuservalue(L, absidx);
+	}
+}
+
+/*
+ * Assign the values of the table at tblidx to the fields of the object at
+ * objidx.  All names are checked before any field is written, and the
+ * fields are restored if assigning a value fails.
+ */
+void
+luacs_object_fromtable(lua_State *L, int objidx, int tblidx)
+{
+	struct luacobject	*obj;
+	struct luacstruct_field	*field;
+	size_t			 start = SIZE_MAX, end = 0, siz;
+	bool			 fallible = false;
+	caddr_t			 saved = NULL;
+	char			 buf[BUFSIZ];
+
+	objidx = lua_absindex(L, objidx);
+	tblidx = lua_absindex(L, tblidx);
+	obj = luacs_checkobj(L, objidx);
+	luaL_checktype(L, tblidx, LUA_TTABLE);
+
+	lua_pushnil(L);
+	while (lua_next(L, tblidx) != 0) {
+		lua_pop(L, 1);
+		if (lua_type(L, -1) != LUA_TSTRING)
+			luaL_error(L, "field name must be a string, got %s",
+			    luaL_typename(L, -1));
+		if ((field = luacs_lookupfield(L, obj->cs, -1)) == NULL)
+			luaL_error(L, "`struct %s' doesn't have field `%s'",
+			    obj->cs->typename, lua_tostring(L, -1));
+		if ((field->flags & LUACS_FREADONLY) != 0)
+			goto readonly;
+		switch (field->type) {
+		case LUACS_TSTRPTR:
+		case LUACS_TWSTRPTR:
+		case LUACS_TMETHOD:
+		case LUACS_TCONST:
+readonly:
+			luaL_error(L, "field `%s' is readonly",
+			    field->fieldname);
+			break;
+		case LUACS_TINT8:
+		case LUACS_TINT16:
+		case LUACS_TINT32:
+		case LUACS_TINT64:
+		case LUACS_TUINT8:
+		case LUACS_TUINT16:
+		case LUACS_TUINT32:
+		case LUACS_TUINT64:
+		case LUACS_TBOOL:
+			/* assigning these never fails */
+			break;
+		default:
+			fallible = true;
+			break;
+		}
+		siz = (field->nmemb == 0? 1 : field->nmemb) *
+		    field->region.size;
+		start = MINIMUM(start, (size_t)field->region.off);
+		end = MAXIMUM(end, field->region.off + siz);
+	}
+	if (!fallible) {
+		luacs_object_fromtable1(L, obj, objidx, tblidx);
+		return;
+	}
+
+	/* save the fields to restore them on an error */
+	if (start < end) {
+		if ((saved = malloc(end - start)) == NULL) {
+			strerror_r(errno, buf, sizeof(buf));
+			lua_pushstring(L, buf);
+			lua_error(L);
+		}
+		memcpy(saved, obj->ptr + start, end - start);
+	}
+	lua_pushcfunction(L, luacs_object_fromtable0);
+	lua_pushvalue(L, objidx);
+	lua_pushvalue(L, tblidx);
+	if (lua_pcall(L, 2, 0, 0) != 0) {
+		if (saved != NULL)
+			memcpy(obj->ptr + start, saved, end - start);
+		free(saved);
+		lua_error(L);
+	}
+	free(saved);
+}
+
+int
+luacs_object_fromtable0(lua_State *L)
+{
+	luacs_object_fromtable1(L, lua_touserdata(L, 1), 1, 2);
+	return (0);
+}
+
+void
+luacs_object_fromtable1(lua_State *L, struct luacobject *obj, int objidx,
+    int tblidx)
+{
+	struct luacstruct_field	*field;
+	int			 extref = 0;
+
+	lua_pushnil(L);
+	while (lua_next(L, tblidx) != 0) {
+		field = luacs_lookupfield(L, obj->cs, -2);
+		switch (field->type) {
+		default:
+			luacs_pullregion(L, obj, &field->region, -1);
+			break;
+		case LUACS_TEXTREF:
+			/* can't be restored, assign them at last */
+			extref++;
+			break;
+		case LUACS_TOBJREF:
+		case LUACS_TOBJENT:
+		case LUACS_TARRAY:
+			lua_pushvalue(L, -2);
+			lua_pushvalue(L, -2);
+			lua_settable(L, objidx);
+			break;
+		}
+		lua_pop(L, 1);
+	}
+	lua_pushnil(L);
+	while (extref > 0 && lua_next(L, tblidx) != 0) {
+		field = luacs_lookupfield(L, obj->cs, -2);
+		if (field->type == LUACS_TEXTREF) {
+			lua_pushvalue(L, -2);
+			lua_pushvalue(L, -2);
+			lua_settable(L, objidx);
+			if (--extref == 0)
+				lua_pop(L, 1);
+		}
+		lua_pop(L, 1);
 	}
-	lua_pop(L, 1);
 }
 
 void
@@ -1273,8 +3175,8 @@ luacs_object__eq(lua_State *L)
 		lua_pushboolean(L, false);
 		return (1);
 	}
-	obja = luaL_checkudata(L, 1, METANAME_LUACSTRUCTOBJ);
-	objb = luaL_checkudata(L, 2, METANAME_LUACSTRUCTOBJ);
+	obja = luacs_checkobj(L, 1);
+	objb = luacs_checkobj(L, 2);
 	if (ptra == ptrb) {		/* the same pointer */
 		if (obja == objb ||	/* the same type */
 		    strcmp(obja->cs->typename, objb->cs->typename) == 0) {
@@ -1302,7 +3204,11 @@ luacs_object__tostring(lua_State *L)
 	char			 buf[BUFSIZ];
 
 	lua_settop(L, 1);
-	obj = luaL_checkudata(L, 1, METANAME_LUACSTRUCTOBJ);
+	obj = luacs_checkobj0(L, 1);
+	if (obj->ptr == NULL) {
+		lua_pushfstring(L, "struct %s: released", obj->cs->typename);
+		return (1);
+	}
 
 	lua_getfield(L, 1, "__tostring");
 	if (!lua_isnil(L, -1)) {
@@ -1338,13 +3244,20 @@ int
 luacs_object__index(lua_State *L)
 {
 	struct luacobject	*obj;
-	struct luacstruct_field	 fkey, *field;
+	struct luacstruct_field	*field;
 
 	lua_settop(L, 2);
-	obj = luaL_checkudata(L, 1, METANAME_LUACSTRUCTOBJ);
-	fkey.fieldname = luaL_checkstring(L, 2);
-	if ((field = SPLAY_FIND(luacstruct_fields, &obj->cs->fields, &fkey))
-	    != NULL)
+	obj = luacs_checkobj_mt(L, 1, lua_upvalueindex(2));
+	/* methods and constants, which are not keyed by the ordinals */
+	if (lua_type(L, 2) == LUA_TNUMBER)
+		goto field;
+	lua_pushvalue(L, 2);
+	lua_rawget(L, lua_upvalueindex(1));
+	if (!lua_isnil(L, -1))
+		return (1);
+	lua_pop(L, 1);
+field:
+	if ((field = luacs_lookupfield(L, obj->cs, 2)) != NULL)
 		return (luacs_object__get(L, obj, field));
 	else
 		lua_pushnil(L);
@@ -1371,42 +3284,43 @@ luacs_object__get(lua_State *L, struct luacobject *obj,
 		else {
 			struct luacobject *cache = NULL;
 
-			luacs_usertable(L, 1);
-			lua_getfield(L, -1, field->fieldname);
+			luacs_usertable(L, 1, obj->cs->nslots);
+			lua_rawgeti(L, -1, field->slot);
 			if (lua_isnil(L, -1))
 				lua_pop(L, 1);
 			else {	/* has a cache */
-				cache = luaL_checkudata(L, -1,
-				    METANAME_LUACSTRUCTOBJ);
+				cache = luacs_checkobj(L, -1);
 				/* cached reference may be staled */
 				if (field->type == LUACS_TOBJREF &&
 				    cache->ptr !=
 				    *(void **)(obj->ptr + field->region.off)) {
 					lua_pop(L, 1);
 					lua_pushnil(L);
-					lua_setfield(L, -2, field->fieldname);
+					lua_rawseti(L, -2, field->slot);
 					cache = NULL;
 				}
 			}
 			if (cache == NULL) {
 				luacs_getref(L, field->region.typref);
 				luacs_newobject0(L, ptr);
+				if (field->type == LUACS_TOBJENT)
+					luacs_nestborrowed(L, obj);
 				lua_pushvalue(L, -1);
-				lua_setfield(L, -4, field->fieldname);
+				lua_rawseti(L, -4, field->slot);
 				lua_remove(L, -2);
 			}
 			lua_remove(L, -2);
 		}
 		break;
 	case LUACS_TEXTREF:
-		luacs_usertable(L, 1);
-		lua_getfield(L, -1, field->fieldname);
+		luacs_usertable(L, 1, obj->cs->nslots);
+		lua_rawgeti(L, -1, field->slot);
 		lua_remove(L, -2);
 		break;
 	case LUACS_TARRAY:
 		/* use the cache if any */
-		luacs_usertable(L, 1);
-		lua_getfield(L, -1, field->fieldname);
+		luacs_usertable(L, 1, obj->cs->nslots);
+		lua_rawgeti(L, -1, field->slot);
 		if (lua_isnil(L, -1)) {
 			lua_pop(L, 1);
 			if (field->region.typref != 0)
@@ -1417,8 +3331,9 @@ luacs_object__get(lua_State *L, struct luacobject *obj,
 			    obj->ptr + field->region.off);
 			if (field->region.typref != 0)
 				lua_remove(L, -2);
+			luacs_nestborrowed(L, obj);
 			lua_pushvalue(L, -1);
-			lua_setfield(L, -3, field->fieldname);
+			lua_rawseti(L, -3, field->slot);
 		}
 		lua_remove(L, -2);
 		break;
@@ -1438,13 +3353,11 @@ luacs_object__newindex(lua_State *L)
 {
 	struct luacstruct	*cs0;
 	struct luacobject	*obj, *ano = NULL;
-	struct luacstruct_field	 fkey, *field;
+	struct luacstruct_field	*field;
 
 	lua_settop(L, 3);
-	obj = luaL_checkudata(L, 1, METANAME_LUACSTRUCTOBJ);
-	fkey.fieldname = luaL_checkstring(L, 2);
-	if ((field = SPLAY_FIND(luacstruct_fields, &obj->cs->fields, &fkey))
-	    != NULL) {
+	obj = luacs_checkobj_mt(L, 1, lua_upvalueindex(1));
+	if ((field = luacs_lookupfield(L, obj->cs, 2)) != NULL) {
 		if ((field->flags & LUACS_FREADONLY) != 0) {
 readonly:
 			lua_pushfstring(L, "field `%s' is readonly",
@@ -1467,8 +3380,7 @@ readonly:
 			if (field->region.type == LUACS_TOBJENT ||
 			    !lua_isnil(L, 3))
 				/* given instance of struct */
-				ano = luaL_checkudata(L, 3,
-				    METANAME_LUACSTRUCTOBJ);
+				ano = luacs_checkobj(L, 3);
 			/* given instance of struct */
 			if (ano != NULL && cs0 != ano->cs) {
 				lua_pushfstring(L,
@@ -1486,16 +3398,16 @@ readonly:
 				*(void **)(obj->ptr + field->region.off) =
 				    ano != NULL? ano->ptr : NULL;
 				/* use the same object */
-				luacs_usertable(L, 1);
+				luacs_usertable(L, 1, obj->cs->nslots);
 				lua_pushvalue(L, 3);
-				lua_setfield(L, -2, field->fieldname);
+				lua_rawseti(L, -2, field->slot);
 				lua_pop(L, 1);
 			}
 			break;
 		case LUACS_TEXTREF:
-			luacs_usertable(L, 1);
+			luacs_usertable(L, 1, obj->cs->nslots);
 			lua_pushvalue(L, 3);
-			lua_setfield(L, -2, field->fieldname);
+			lua_rawseti(L, -2, field->slot);
 			lua_pop(L, 1);
 			break;
 		case LUACS_TARRAY:
@@ -1507,13 +3419,81 @@ readonly:
 		}
 	} else {
 		lua_pushfstring(L, "`struct %s' doesn't have field `%s'",
-		    obj->cs->typename, fkey.fieldname);
+		    obj->cs->typename, luaL_checkstring(L, 2));
 		lua_error(L);
 	}
 
 	return (0);
 }
 
+/* obj:get(name, ...) returns the values of the fields */
+int
+luacs_object_get(lua_State *L)
+{
+	struct luacobject	*obj;
+	struct luacstruct_field	*field;
+	int			 i, nargs;
+
+	obj = luacs_checkobj_mt(L, 1, lua_upvalueindex(1));
+	nargs = lua_gettop(L);
+	for (i = 2; i <= nargs; i++) {
+		luaL_checkstack(L, LUA_MINSTACK, NULL);
+		if ((field = luacs_lookupfield(L, obj->cs, i)) != NULL)
+			luacs_object__get(L, obj, field);
+		else
+			lua_pushnil(L);
+	}
+
+	return (nargs - 1);
+}
+
+/* obj:set(tbl) assigns the values of the table to the fields */
+int
+luacs_object_set(lua_State *L)
+{
+	lua_settop(L, 2);
+	luacs_checkobj_mt(L, 1, lua_upvalueindex(1));
+	luacs_object_fromtable(L, 1, 2);
+
+	return (0);
+}
+
+/*
+ * obj:totable([depth]) creates a table which has the values of the fields.
+ * Nested objects and arrays are converted to tables as well while the depth
+ * is more than 1.
+ */
+int
+luacs_object_totable(lua_State *L)
+{
+	struct luacobject	*obj;
+	struct luacstruct_field	*field;
+	int			 depth;
+
+	obj = luacs_checkobj_mt(L, 1, lua_upvalueindex(1));
+	depth = luaL_optinteger(L, 2, 1);
+	lua_settop(L, 2);
+	lua_createtable(L, 0, obj->cs->nfields);
+
+	TAILQ_FOREACH(field, &obj->cs->sorted, queue) {
+		if (field->type == LUACS_TMETHOD ||
+		    field->type == LUACS_TCONST)
+			continue;
+		luacs_object__get(L, obj, field);
+		if (depth > 1 && !lua_isnil(L, -1)) {
+			if (field->type == LUACS_TOBJENT)
+				luacs_totable(L, luacs_object_totable,
+				    depth - 1);
+			else if (field->type == LUACS_TARRAY)
+				luacs_totable(L, luacs_array_totable,
+				    depth - 1);
+		}
+		lua_setfield(L, 3, field->fieldname);
+	}
+
+	return (1);
+}
+
 int
 luacs_object_copy(lua_State *L)
 {
@@ -1521,8 +3501,8 @@ luacs_object_copy(lua_State *L)
 	struct luacstruct_field	*field;
 
 	lua_settop(L, 2);
-	l = luaL_checkudata(L, 1, METANAME_LUACSTRUCTOBJ);
-	r = luaL_checkudata(L, 2, METANAME_LUACSTRUCTOBJ);
+	l = luacs_checkobj(L, 1);
+	r = luacs_checkobj(L, 2);
 	if (l->cs != r->cs) {
 		lua_pushfstring(L,
 		    "copying from `struct %s' instance to `struct %s' "
@@ -1548,27 +3528,43 @@ luacs_object_copy(lua_State *L)
 	return (0);
 }
 
+/*
+ * The iterator keeps the position of the last field in the 2nd upvalue, so
+ * that it doesn't need to find the field by the given key usually.  The
+ * 3rd upvalue is the table of the field names.
+ */
 int
 luacs_object__next(lua_State *L)
 {
 	struct luacobject	*obj;
-	struct luacstruct_field	*field, fkey;
+	struct luacstruct_field	*field, **fieldv;
+	int			 pos = 0;
 
 	lua_settop(L, 2);
-	obj = luaL_checkudata(L, 1, METANAME_LUACSTRUCTOBJ);
-	if (lua_isnil(L, 2))
-		field = TAILQ_FIRST(&obj->cs->sorted);
-	else {
-		fkey.fieldname = luaL_checkstring(L, 2);
-		field = SPLAY_FIND(luacstruct_fields, &obj->cs->fields, &fkey);
-		if (field != NULL)
-			field = TAILQ_NEXT(field, queue);
+	obj = luacs_checkobj_mt(L, 1, lua_upvalueindex(1));
+	fieldv = luacs_fieldv(L, obj->cs);
+	if (!lua_isnil(L, 2)) {
+		pos = lua_tointeger(L, lua_upvalueindex(2));
+		if (0 < pos && pos <= obj->cs->nfieldv)
+			lua_rawgeti(L, lua_upvalueindex(3), pos);
+		else
+			lua_pushnil(L);
+		if (!lua_rawequal(L, -1, 2)) {
+			/* not continued from the last, find the key */
+			field = luacs_findfield(obj->cs, luaL_checkstring(L, 2));
+			pos = (field != NULL)? field->ordinal + 1 :
+			    obj->cs->nfieldv;
+		}
+		lua_pop(L, 1);
 	}
-	if (field == NULL) {
+	if (obj->cs->nfieldv <= pos) {
 		lua_pushnil(L);
 		return (1);
 	}
-	lua_pushstring(L, field->fieldname);
+	field = fieldv[pos++];
+	lua_pushinteger(L, pos);
+	lua_replace(L, lua_upvalueindex(2));
+	lua_rawgeti(L, lua_upvalueindex(3), pos);
 	luacs_object__get(L, obj, field);
 
 	return (2);
@@ -1577,8 +3573,15 @@ luacs_object__next(lua_State *L)
 int
 luacs_object__pairs(lua_State *L)
 {
+	struct luacobject	*obj;
+
 	lua_settop(L, 1);
+	obj = luacs_checkobj_mt(L, 1, lua_upvalueindex(1));
+	luacs_fieldv(L, obj->cs);
 	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_pushinteger(L, 0);
+	luacs_getref(L, obj->cs->fieldvref);
+	lua_pushcclosure(L, luacs_object__next, 3);
 	lua_pushvalue(L, 1);
 	lua_pushnil(L);
 
@@ -1586,341 +3589,710 @@ luacs_object__pairs(lua_State *L)
 }
 
 int
-luacs_object__gc(lua_State *L)
+luacs_object__gc(lua_State *L)
+{
+	struct luacobject	*obj;
+	struct luacstruct_field	*field;
+
+	lua_settop(L, 1);
+	/* a released object is also collected */
+	if ((obj = lua_touserdata(L, 1)) == NULL || !lua_getmetatable(L, 1) ||
+	    !lua_rawequal(L, -1, lua_upvalueindex(1)))
+		obj = luacs_checkobj0(L, 1);
+	lua_settop(L, 1);
+	/* the struct of a borrowed object is not owned */
+	if ((obj->flags & LUACS_OFBORROWED) == 0 &&
+	    (field = luacs_findfield(obj->cs, "__gc")) != NULL &&
+	    field->type == LUACS_TMETHOD) {
+		luacs_getref(L, field->ref);
+		lua_pushvalue(L, 1);
+		lua_pcall(L, 1, 0, 0);
+	}
+
+	return (0);
+}
+
+void *
+luacs_checkobject(lua_State *L, int idx, const char *typename)
+{
+	struct luacobj_compat	 compat;
+
+	memset(&compat, 0, sizeof(compat));
+	luacs_object_compat(L, idx, &compat);
+
+	if (compat.typ != NULL && strcmp(compat.typ, typename) == 0)
+		return (compat.ptr);
+
+	luaL_error(L, "%s expected, got %s",
+	    typename, (compat.typ != NULL)? compat.typ : luaL_typename(L, idx));
+	/* NOTREACHED */
+	LUACS_ASSERT(L, 0);
+	abort();
+}
+
+/*
+ * Same as luacs_checkobject(), but the struct is specified by the handle.
+ * The metatable is compared by the pointer, then falls back to comparing
+ * the name for the objects created by another variant.
+ */
+void *
+luacs_checkobject_h(lua_State *L, int idx, luacs_typehandle_t cs)
+{
+	struct luacobject	*obj;
+
+	if ((obj = lua_touserdata(L, idx)) != NULL &&
+	    lua_getmetatable(L, idx)) {
+		if (lua_topointer(L, -1) == cs->meta) {
+			lua_pop(L, 1);
+			return (obj->ptr);
+		}
+		lua_pop(L, 1);
+	}
+
+	return (luacs_checkobject(L, idx, cs->typename));
+}
+
+/* field handle */
+/*
+ * Resolve the path like "a.b[3].c" from the struct into the region of the
+ * leaf field.  The offsets of the fields referred by pointers on the path
+ * are stored in hops, and the offset of the leaf is relative to the last
+ * of them.  The pointers are not allowed if hops is NULL.
+ */
+void
+luacs_resolvepath(lua_State *L, struct luacstruct *cs, const char *path,
+    struct luacregion *leaf, int *hops, int *nhops)
+{
+	struct luacstruct_field	*field;
+	struct luacarraytype	*cat;
+	struct luacregion	 elem;
+	const char		*p;
+	char			*ep;
+	int			 i, off = 0, nmemb = 0;
+	size_t			 len;
+
+	if (nhops != NULL)
+		*nhops = 0;
+	memset(leaf, 0, sizeof(*leaf));
+	memset(&elem, 0, sizeof(elem));
+	for (p = path; *p != '\0'; ) {
+		if (*p == '[') {
+			/* an index of the array */
+			if (nmemb == 0)
+				goto invalid;
+			i = strtol(p + 1, &ep, 10);
+			if (ep == p + 1 || *ep != ']')
+				goto invalid;
+			p = ep + 1;
+			if (i < 1 || nmemb < i)
+				luaL_error(L, "array index %d out of the range "
+				    "1:%d in `%s'", i, nmemb, path);
+			off += (i - 1) * elem.size;
+			nmemb = 0;
+			switch (elem.type) {
+			case LUACS_TARRAY:
+				luacs_getref(L, elem.typref);
+				cat = luaL_checkudata(L, -1,
+				    METANAME_LUACARRAYTYPE);
+				lua_pop(L, 1);
+				elem.type = cat->type;
+				elem.size = cat->size;
+				elem.typref = cat->typref;
+				elem.flags = cat->flags;
+				elem.acc = luacs_region_accessor(cat->type,
+				    cat->size, cat->flags);
+				nmemb = cat->nmemb;
+				break;
+			case LUACS_TOBJREF:
+			case LUACS_TOBJENT:
+				if (elem.type == LUACS_TOBJREF) {
+					if (hops == NULL)
+						goto pointer;
+					if (*nhops >= LUACS_FIELDHANDLEMAXHOPS)
+						goto toodeep;
+					hops[(*nhops)++] = off;
+					off = 0;
+				}
+				luacs_getref(L, elem.typref);
+				cs = luacs_checkstruct(L, -1);
+				lua_pop(L, 1);
+				break;
+			case LUACS_TEXTREF:
+				goto notvalue;
+			default:
+				*leaf = elem;
+				leaf->off = off;
+				break;
+			}
+			continue;
+		}
+		if (p != path && *p++ != '.')
+			goto invalid;
+		if (cs == NULL)
+			goto invalid;
+		len = strcspn(p, ".[");
+		lua_pushlstring(L, p, len);
+		if ((field = luacs_findfield(cs, lua_tostring(L, -1))) == NULL)
+			luaL_error(L, "`struct %s' doesn't have field `%s'",
+			    cs->typename, lua_tostring(L, -1));
+		lua_pop(L, 1);
+		p += len;
+		cs = NULL;
+		off += field->region.off;
+		switch (field->type) {
+		case LUACS_TARRAY:
+			elem = field->region;
+			nmemb = field->nmemb;
+			break;
+		case LUACS_TOBJREF:
+		case LUACS_TOBJENT:
+			if (field->type == LUACS_TOBJREF) {
+				if (hops == NULL)
+					goto pointer;
+				if (*nhops >= LUACS_FIELDHANDLEMAXHOPS)
+					goto toodeep;
+				hops[(*nhops)++] = off;
+				off = 0;
+			}
+			luacs_getref(L, field->region.typref);
+			cs = luacs_checkstruct(L, -1);
+			lua_pop(L, 1);
+			break;
+		case LUACS_TEXTREF:
+		case LUACS_TMETHOD:
+		case LUACS_TCONST:
+			goto notvalue;
+		default:
+			*leaf = field->region;
+			leaf->off = off;
+			break;
+		}
+	}
+	if (leaf->acc == NULL) {
+notvalue:
+		luaL_error(L, "`%s' doesn't refer a field of a value", path);
+	}
+	return;
+invalid:
+	luaL_error(L, "invalid path `%s'", path);
+	return;
+pointer:
+	luaL_error(L, "`%s' refers a field through a pointer", path);
+	return;
+toodeep:
+	luaL_error(L, "too many pointers in `%s'", path);
+}
+
+/*
+ * T.field(path) resolves the path from the struct T at once.  The handle
+ * keeps the result, so that h:get(obj) and h:set(obj, value) access the
+ * leaf field from the pointer of obj directly.
+ */
+int
+luacs_struct_field(lua_State *L)
+{
+	struct luacstruct	*cs;
+	struct luacfieldhandle	*hdl;
+	struct luacregion	 leaf;
+	int			 nhops, hops[LUACS_FIELDHANDLEMAXHOPS];
+
+	cs = luacs_checkstruct(L, lua_upvalueindex(1));
+	luacs_resolvepath(L, cs, luaL_checkstring(L, 1), &leaf, hops, &nhops);
+
+	hdl = lua_newuserdata(L, offsetof(struct luacfieldhandle,
+	    hops[nhops]));
+	hdl->cs = cs;
+	hdl->csref = 0;
+	hdl->region = leaf;
+	hdl->region.typref = 0;
+	hdl->nhops = nhops;
+	memcpy(hdl->hops, hops, sizeof(hops[0]) * nhops);
+	if (luaL_newmetatable(L, METANAME_LUACFIELDHANDLE) != 0) {
+		lua_newtable(L);
+		lua_pushvalue(L, -2);
+		lua_pushcclosure(L, luacs_fieldhandle_get, 1);
+		lua_setfield(L, -2, "get");
+		lua_pushvalue(L, -2);
+		lua_pushcclosure(L, luacs_fieldhandle_set, 1);
+		lua_setfield(L, -2, "set");
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, luacs_fieldhandle__gc);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+	/* the struct and the enum must live longer than the handle */
+	lua_pushvalue(L, lua_upvalueindex(1));
+	hdl->csref = luacs_ref(L);
+	if (leaf.typref != 0) {
+		luacs_getref(L, leaf.typref);
+		hdl->region.typref = luacs_ref(L);
+	}
+
+	return (1);
+}
+
+/*
+ * Check the handle and the object given for the methods, then get the
+ * pointer to the struct which has the leaf field.  NULL is returned if a
+ * pointer on the path is NULL.
+ */
+struct luacfieldhandle *
+luacs_fieldhandle_base(lua_State *L, caddr_t *base)
+{
+	struct luacfieldhandle	*hdl;
+	struct luacobject	*obj;
+	int			 i;
+
+	if ((hdl = lua_touserdata(L, 1)) == NULL || !lua_getmetatable(L, 1) ||
+	    !lua_rawequal(L, -1, lua_upvalueindex(1)))
+		hdl = luaL_checkudata(L, 1, METANAME_LUACFIELDHANDLE);
+	obj = luacs_checkobj(L, 2);
+	if (obj->cs != hdl->cs)
+		luaL_error(L, "the handle is for `struct %s', not `struct %s'",
+		    hdl->cs->typename, obj->cs->typename);
+	*base = obj->ptr;
+	for (i = 0; *base != NULL && i < hdl->nhops; i++)
+		*base = *(caddr_t *)(*base + hdl->hops[i]);
+
+	return (hdl);
+}
+
+/* h:get(obj) returns the value of the field */
+int
+luacs_fieldhandle_get(lua_State *L)
+{
+	struct luacfieldhandle	*hdl;
+	struct luacobject	 base;
+
+	lua_settop(L, 2);
+	hdl = luacs_fieldhandle_base(L, &base.ptr);
+	if (base.ptr == NULL) {
+		lua_pushnil(L);
+		return (1);
+	}
+
+	return (luacs_pushregion(L, &base, &hdl->region));
+}
+
+/* h:set(obj, value) assigns the value to the field */
+int
+luacs_fieldhandle_set(lua_State *L)
 {
-	struct luacobject	*obj;
-	struct luacstruct_field	 fkey, *field;
+	struct luacfieldhandle	*hdl;
+	struct luacobject	 base;
 
-	lua_settop(L, 1);
-	obj = luaL_checkudata(L, 1, METANAME_LUACSTRUCTOBJ);
-	fkey.fieldname = "__gc";
-	if ((field = SPLAY_FIND(luacstruct_fields, &obj->cs->fields, &fkey))
-	    != NULL && field->type == LUACS_TMETHOD) {
-		luacs_getref(L, field->ref);
-		lua_pushvalue(L, 1);
-		lua_pcall(L, 1, 0, 0);
-	}
-	luacs_unref(L, obj->typref);
-	luacs_deleteusertable(L, 1);
+	lua_settop(L, 3);
+	hdl = luacs_fieldhandle_base(L, &base.ptr);
+	if ((hdl->region.flags & LUACS_FREADONLY) != 0 ||
+	    hdl->region.type == LUACS_TSTRPTR ||
+	    hdl->region.type == LUACS_TWSTRPTR)
+		luaL_error(L, "the field is readonly");
+	if (base.ptr == NULL)
+		luaL_error(L, "the field is referred through a NULL pointer");
+	luacs_pullregion(L, &base, &hdl->region, 3);
 
 	return (0);
 }
 
-void *
-luacs_checkobject(lua_State *L, int idx, const char *typename)
+int
+luacs_fieldhandle__gc(lua_State *L)
 {
-	struct luacobj_compat	 compat;
+	struct luacfieldhandle	*hdl;
 
-	memset(&compat, 0, sizeof(compat));
-	luacs_object_compat(L, idx, &compat);
-
-	if (compat.typ != NULL && strcmp(compat.typ, typename) == 0)
-		return (compat.ptr);
+	hdl = luaL_checkudata(L, 1, METANAME_LUACFIELDHANDLE);
+	if (hdl->region.typref != 0)
+		luacs_unref(L, hdl->region.typref);
+	hdl->region.typref = 0;
+	if (hdl->csref != 0)
+		luacs_unref(L, hdl->csref);
+	hdl->csref = 0;
 
-	luaL_error(L, "%s expected, got %s",
-	    typename, (compat.typ != NULL)? compat.typ : luaL_typename(L, idx));
-	/* NOTREACHED */
-	LUACS_ASSERT(L, 0);
-	abort();
+	return (0);
 }
 
 /* region */
-int
-luacs_pushregion(lua_State *L, struct luacobject *obj,
-    struct luacregion *region)
-{
-	intmax_t	 ival;
-	uintmax_t	 uval;
+/*
+ * The accessors of the regions.  The getter and the setter for the type,
+ * the width and the byte order of a region are resolved when the region is
+ * declared, so that accessing the region doesn't need to examine them.
+ */
+#define LUACS_INT_ACCESSOR(_name, _ctype, _toh, _hto)			\
+static int								\
+luacs_get_##_name(lua_State *L, struct luacobject *obj,		\
+    struct luacregion *region)						\
+{									\
+	lua_pushinteger(L,						\
+	    (_ctype)_toh(*(_ctype *)(obj->ptr + region->off)));	\
+	return (1);							\
+}									\
+static void								\
+luacs_set_##_name(lua_State *L, struct luacobject *obj,		\
+    struct luacregion *region, int idx)				\
+{									\
+	*(_ctype *)(obj->ptr + region->off) =				\
+	    _hto((_ctype)lua_tointeger(L, idx));			\
+}
+
+LUACS_INT_ACCESSOR(i8,		int8_t,		,	)
+LUACS_INT_ACCESSOR(i16,		int16_t,	,	)
+LUACS_INT_ACCESSOR(i16_be,	int16_t,	be16toh, htobe16)
+LUACS_INT_ACCESSOR(i16_le,	int16_t,	le16toh, htole16)
+LUACS_INT_ACCESSOR(i32,		int32_t,	,	)
+LUACS_INT_ACCESSOR(i32_be,	int32_t,	be32toh, htobe32)
+LUACS_INT_ACCESSOR(i32_le,	int32_t,	le32toh, htole32)
+LUACS_INT_ACCESSOR(i64,		int64_t,	,	)
+LUACS_INT_ACCESSOR(i64_be,	int64_t,	be64toh, htobe64)
+LUACS_INT_ACCESSOR(i64_le,	int64_t,	le64toh, htole64)
+LUACS_INT_ACCESSOR(u8,		uint8_t,	,	)
+LUACS_INT_ACCESSOR(u16,		uint16_t,	,	)
+LUACS_INT_ACCESSOR(u16_be,	uint16_t,	be16toh, htobe16)
+LUACS_INT_ACCESSOR(u16_le,	uint16_t,	le16toh, htole16)
+LUACS_INT_ACCESSOR(u32,		uint32_t,	,	)
+LUACS_INT_ACCESSOR(u32_be,	uint32_t,	be32toh, htobe32)
+LUACS_INT_ACCESSOR(u32_le,	uint32_t,	le32toh, htole32)
+LUACS_INT_ACCESSOR(u64,		uint64_t,	,	)
+LUACS_INT_ACCESSOR(u64_be,	uint64_t,	be64toh, htobe64)
+LUACS_INT_ACCESSOR(u64_le,	uint64_t,	le64toh, htole64)
+
+#define LUACS_ENUM_ACCESSOR(_name, _ctype)				\
+static int								\
+luacs_get_##_name(lua_State *L, struct luacobject *obj,		\
+    struct luacregion *region)						\
+{									\
+	return (luacs_pushenum(L, region,				\
+	    *(_ctype *)(obj->ptr + region->off)));			\
+}									\
+static void								\
+luacs_set_##_name(lua_State *L, struct luacobject *obj,		\
+    struct luacregion *region, int idx)				\
+{									\
+	*(_ctype *)(obj->ptr + region->off) =				\
+	    luacs_toenum(L, region, idx);				\
+}
 
-	switch (region->type) {
+LUACS_ENUM_ACCESSOR(enum8,	int8_t)
+LUACS_ENUM_ACCESSOR(enum16,	int16_t)
+LUACS_ENUM_ACCESSOR(enum32,	int32_t)
+LUACS_ENUM_ACCESSOR(enum64,	int64_t)
+
+#define LUACS_ACCESSOR(_name)	{ luacs_get_##_name, luacs_set_##_name }
+
+static const struct luacregion_accessor luacs_int_accessors[][3] = {
+	/* native, big endian, little endian */
+	{ LUACS_ACCESSOR(i8), LUACS_ACCESSOR(i8), LUACS_ACCESSOR(i8) },
+	{ LUACS_ACCESSOR(i16), LUACS_ACCESSOR(i16_be), LUACS_ACCESSOR(i16_le) },
+	{ LUACS_ACCESSOR(i32), LUACS_ACCESSOR(i32_be), LUACS_ACCESSOR(i32_le) },
+	{ LUACS_ACCESSOR(i64), LUACS_ACCESSOR(i64_be), LUACS_ACCESSOR(i64_le) },
+	{ LUACS_ACCESSOR(u8), LUACS_ACCESSOR(u8), LUACS_ACCESSOR(u8) },
+	{ LUACS_ACCESSOR(u16), LUACS_ACCESSOR(u16_be), LUACS_ACCESSOR(u16_le) },
+	{ LUACS_ACCESSOR(u32), LUACS_ACCESSOR(u32_be), LUACS_ACCESSOR(u32_le) },
+	{ LUACS_ACCESSOR(u64), LUACS_ACCESSOR(u64_be), LUACS_ACCESSOR(u64_le) }
+};
+static const struct luacregion_accessor luacs_enum_accessors[] = {
+	LUACS_ACCESSOR(enum8), LUACS_ACCESSOR(enum16),
+	LUACS_ACCESSOR(enum32), LUACS_ACCESSOR(enum64),
+	LUACS_ACCESSOR(enum_broken)
+};
+static const struct luacregion_accessor luacs_bool_accessor =
+	LUACS_ACCESSOR(bool);
+static const struct luacregion_accessor luacs_string_accessor =
+	LUACS_ACCESSOR(string);
+static const struct luacregion_accessor luacs_strptr_accessor =
+	LUACS_ACCESSOR(strptr);
+static const struct luacregion_accessor luacs_wstring_accessor =
+	LUACS_ACCESSOR(wstring);
+static const struct luacregion_accessor luacs_wstrptr_accessor =
+	LUACS_ACCESSOR(wstrptr);
+static const struct luacregion_accessor luacs_bytearray_accessor =
+	LUACS_ACCESSOR(bytearray);
+static const struct luacregion_accessor luacs_none_accessor =
+	LUACS_ACCESSOR(none);
+
+const struct luacregion_accessor *
+luacs_region_accessor(enum luacstruct_type _type, size_t size,
+    unsigned flags)
+{
+	switch (_type) {
 	case LUACS_TINT8:
-		lua_pushinteger(L, *(int8_t *)(obj->ptr + region->off));
-		break;
 	case LUACS_TINT16:
-		ival = *(int16_t *)(obj->ptr + region->off);
-		if ((region->flags & LUACS_FENDIAN) == 0)
-			lua_pushinteger(L, ival);
-		else if ((region->flags & LUACS_FENDIANBIG) != 0)
-			lua_pushinteger(L, be16toh(ival));
-		else
-			lua_pushinteger(L, le16toh(ival));
-		break;
 	case LUACS_TINT32:
-		ival = *(int32_t *)(obj->ptr + region->off);
-		if ((region->flags & LUACS_FENDIAN) == 0)
-			lua_pushinteger(L, ival);
-		else if ((region->flags & LUACS_FENDIANBIG) != 0)
-			lua_pushinteger(L, be32toh(ival));
-		else
-			lua_pushinteger(L, le32toh(ival));
-		break;
 	case LUACS_TINT64:
-		ival = *(int64_t *)(obj->ptr + region->off);
-		if ((region->flags & LUACS_FENDIAN) == 0)
-			lua_pushinteger(L, ival);
-		else if ((region->flags & LUACS_FENDIANBIG) != 0)
-			lua_pushinteger(L, be64toh(ival));
-		else
-			lua_pushinteger(L, le64toh(ival));
-		break;
 	case LUACS_TUINT8:
-		lua_pushinteger(L, *(uint8_t *)(obj->ptr + region->off));
-		break;
 	case LUACS_TUINT16:
-		uval = *(uint16_t *)(obj->ptr + region->off);
-		if ((region->flags & LUACS_FENDIAN) == 0)
-			lua_pushinteger(L, uval);
-		else if ((region->flags & LUACS_FENDIANBIG) != 0)
-			lua_pushinteger(L, be16toh(uval));
-		else
-			lua_pushinteger(L, le16toh(uval));
-		break;
 	case LUACS_TUINT32:
-		uval = *(uint32_t *)(obj->ptr + region->off);
-		if ((region->flags & LUACS_FENDIAN) == 0)
-			lua_pushinteger(L, uval);
-		else if ((region->flags & LUACS_FENDIANBIG) != 0)
-			lua_pushinteger(L, be32toh(uval));
-		else
-			lua_pushinteger(L, le32toh(uval));
-		break;
 	case LUACS_TUINT64:
-		uval = *(uint64_t *)(obj->ptr + region->off);
-		if ((region->flags & LUACS_FENDIAN) == 0)
-			lua_pushinteger(L, uval);
-		else if ((region->flags & LUACS_FENDIANBIG) != 0)
-			lua_pushinteger(L, be64toh(uval));
-		else
-			lua_pushinteger(L, le64toh(uval));
-		break;
+		return (&luacs_int_accessors[_type - LUACS_TINT8]
+		    [((flags & LUACS_FENDIANBIG) != 0)? 1 :
+		    ((flags & LUACS_FENDIANLITTLE) != 0)? 2 : 0]);
+	case LUACS_TENUM:
+		switch (size) {
+		case 1:	return (&luacs_enum_accessors[0]);
+		case 2:	return (&luacs_enum_accessors[1]);
+		case 4:	return (&luacs_enum_accessors[2]);
+		case 8:	return (&luacs_enum_accessors[3]);
+		}
+		return (&luacs_enum_accessors[4]);
 	case LUACS_TBOOL:
-		lua_pushboolean(L, *(bool *)(obj->ptr + region->off));
-		break;
+		return (&luacs_bool_accessor);
 	case LUACS_TSTRING:
-		lua_pushlstring(L, (const char *)(obj->ptr + region->off),
-		    strnlen(obj->ptr + region->off, region->size));
-		break;
+		return (&luacs_string_accessor);
 	case LUACS_TSTRPTR:
-		lua_pushstring(L, *(const char **)(obj->ptr + region->off));
-		break;
+		return (&luacs_strptr_accessor);
 	case LUACS_TWSTRING:
-	    {
-		wchar_t		*wstr;
-		char		 buf[128];
-		size_t		 wstrlen, wstrmax;
-
-		wstr = (wchar_t *)obj->ptr;
-		wstrmax = region->size / sizeof(wchar_t);
-		wstrlen = wcsnlen(wstr, wstrmax);
-		if (wstrlen == wstrmax) {
-			wstrmax++;	/* for the null character */
-			if ((wstr = calloc(sizeof(wchar_t), wstrmax)) == NULL) {
-				strerror_r(errno, buf, sizeof(buf));
-				lua_pushstring(L, buf);
-				abort();
-			}
-			memcpy(wstr, wstr, region->size);
-			wstr[wstrlen] = L'\0';
-			luacs_pushwstring(L, wstr);
-			free(wstr);
-		} else
-			luacs_pushwstring(L, wstr);
-		break;
-	    }
+		return (&luacs_wstring_accessor);
 	case LUACS_TWSTRPTR:
-		luacs_pushwstring(L,
-		    *(const wchar_t **)(obj->ptr + region->off));
-		break;
-	case LUACS_TENUM:
-	    {
-		intmax_t		 value;
-		struct luacenum_value	*val;
-		struct luacenum		*ce;
-		switch (region->size) {
-		case 1:	value = *(int8_t  *)(obj->ptr + region->off); break;
-		case 2:	value = *(int16_t *)(obj->ptr + region->off); break;
-		case 4:	value = *(int32_t *)(obj->ptr + region->off); break;
-		case 8:	value = *(int64_t *)(obj->ptr + region->off); break;
-		default:
-			luaL_error(L, "%s: obj is broken", __func__);
-			abort();
-		}
-		luacs_getref(L, region->typref);
-		ce = luacs_checkenum(L, -1);
-		lua_pop(L, 1);
-		val = luacs_enum_get0(ce, value);
-		if (val == NULL)
-			lua_pushinteger(L, value);
-		else
-			luacs_getref(L, val->ref);
-		break;
-	    }
+		return (&luacs_wstrptr_accessor);
 	case LUACS_TBYTEARRAY:
-		lua_pushlstring(L, (char *)obj->ptr + region->off,
-		    region->size);
-		break;
+		return (&luacs_bytearray_accessor);
 	default:
-		lua_pushnil(L);
 		break;
 	}
 
-	return (1);
+	return (&luacs_none_accessor);
+}
+
+int
+luacs_pushregion(lua_State *L, struct luacobject *obj,
+    struct luacregion *region)
+{
+	return (region->acc->get(L, obj, region));
 }
 
 void
 luacs_pullregion(lua_State *L, struct luacobject *obj,
     struct luacregion *region, int idx)
 {
-	size_t		 siz;
-	int		 absidx;
-	intmax_t	 ival;
-	uintmax_t	 uval;
+	region->acc->set(L, obj, region, lua_absindex(L, idx));
+}
 
-	absidx = lua_absindex(L, idx);
+int
+luacs_get_bool(lua_State *L, struct luacobject *obj,
+    struct luacregion *region)
+{
+	lua_pushboolean(L, *(bool *)(obj->ptr + region->off));
+	return (1);
+}
 
-	switch (region->type) {
-	case LUACS_TINT8:
-		*(int8_t *)(obj->ptr + region->off) = lua_tointeger(L, absidx);
-		break;
-	case LUACS_TUINT8:
-		*(uint8_t *)(obj->ptr + region->off) = lua_tointeger(L, absidx);
-		break;
-	case LUACS_TINT16:
-		ival = lua_tointeger(L, absidx);
-		if ((region->flags & LUACS_FENDIANBIG) != 0)
-			ival = htobe16(ival);
-		else if ((region->flags & LUACS_FENDIANLITTLE) != 0)
-			ival = htole16(ival);
-		*(int16_t *)(obj->ptr + region->off) = ival;
-		break;
-	case LUACS_TUINT16:
-		uval = lua_tointeger(L, absidx);
-		if ((region->flags & LUACS_FENDIANBIG) != 0)
-			uval = htobe16(uval);
-		else if ((region->flags & LUACS_FENDIANLITTLE) != 0)
-			uval = htole16(uval);
-		*(uint16_t *)(obj->ptr + region->off) = uval;
-		break;
-	case LUACS_TINT32:
-		ival = lua_tointeger(L, absidx);
-		if ((region->flags & LUACS_FENDIANBIG) != 0)
-			ival = htobe32(ival);
-		else if ((region->flags & LUACS_FENDIANLITTLE) != 0)
-			ival = htole32(ival);
-		*(int32_t *)(obj->ptr + region->off) = ival;
-		break;
-	case LUACS_TUINT32:
-		uval = lua_tointeger(L, absidx);
-		if ((region->flags & LUACS_FENDIANBIG) != 0)
-			uval = htobe32(uval);
-		else if ((region->flags & LUACS_FENDIANLITTLE) != 0)
-			uval = htole32(uval);
-		*(uint32_t *)(obj->ptr + region->off) = uval;
-		break;
-	case LUACS_TINT64:
-		ival = lua_tointeger(L, absidx);
-		if ((region->flags & LUACS_FENDIANBIG) != 0)
-			ival = htobe64(ival);
-		else if ((region->flags & LUACS_FENDIANLITTLE) != 0)
-			ival = htole64(ival);
-		*(int64_t *)(obj->ptr + region->off) = ival;
-		break;
-	case LUACS_TUINT64:
-		uval = lua_tointeger(L, absidx);
-		if ((region->flags & LUACS_FENDIANBIG) != 0)
-			uval = htobe64(uval);
-		else if ((region->flags & LUACS_FENDIANLITTLE) != 0)
-			uval = htole64(uval);
-		*(uint64_t *)(obj->ptr + region->off) = uval;
-		break;
-	case LUACS_TBOOL:
-		*(bool *)(obj->ptr + region->off) = lua_toboolean(L, absidx);
-		break;
-	case LUACS_TENUM:
-	    {
-		struct luacenum		*ce;
-		struct luacenum_value	*val;
-		void			*ptr;
-		intmax_t		 value;
+void
+luacs_set_bool(lua_State *L, struct luacobject *obj,
+    struct luacregion *region, int idx)
+{
+	*(bool *)(obj->ptr + region->off) = lua_toboolean(L, idx);
+}
 
-		luacs_getref(L, region->typref);
-		ce = luacs_checkenum(L, -1);
-		if (lua_type(L, absidx) == LUA_TNUMBER) {
-			value = lua_tointeger(L, absidx);
-			if (luacs_enum_get0(ce, value) == NULL) {
-				lua_pushfstring(L,
-				    "must be a valid integer for `enum %s'",
-				    ce->enumname);
-				lua_error(L);
-			}
-		} else if (lua_type(L, absidx) == LUA_TUSERDATA) {
-			lua_pushcclosure(L, luacs_enum_memberof, 1);
-			lua_pushvalue(L, absidx);
-			lua_call(L, 1, 1);
-			if (!lua_toboolean(L, -1))
-				luaL_error(L,
-				    "must be a member of `enum %s",
-				    ce->enumname);
-			val = lua_touserdata(L, absidx);
-			value = val->value;
-		} else {
-			luaL_error(L, "must be a member of `enum %s",
-			    ce->enumname);
-			/* NOTREACHED */
-			abort();
-		}
-		lua_pop(L, 1);
+int
+luacs_get_string(lua_State *L, struct luacobject *obj,
+    struct luacregion *region)
+{
+	lua_pushlstring(L, (const char *)(obj->ptr + region->off),
+	    strnlen(obj->ptr + region->off, region->size));
+	return (1);
+}
+
+void
+luacs_set_string(lua_State *L, struct luacobject *obj,
+    struct luacregion *region, int idx)
+{
+	size_t	 siz;
+
+	luacs_set_bytearray(L, obj, region, idx);
+	siz = lua_rawlen(L, idx);
+	if (siz < region->size)
+		*(char *)(obj->ptr + region->off + siz) = '\0';
+}
 
-		ptr = obj->ptr + region->off;
-		switch (region->size) {
-		case 1: *(int8_t  *)(ptr) = value; break;
-		case 2: *(int16_t *)(ptr) = value; break;
-		case 4: *(int32_t *)(ptr) = value; break;
-		case 8: *(int64_t *)(ptr) = value; break;
+int
+luacs_get_bytearray(lua_State *L, struct luacobject *obj,
+    struct luacregion *region)
+{
+	lua_pushlstring(L, (char *)obj->ptr + region->off, region->size);
+	return (1);
+}
+
+void
+luacs_set_bytearray(lua_State *L, struct luacobject *obj,
+    struct luacregion *region, int idx)
+{
+	size_t	 siz;
+
+	luaL_checklstring(L, idx, &siz);
+	luaL_argcheck(L, siz <= region->size, idx, "too long");
+	siz = MINIMUM(siz, region->size);
+	memcpy(obj->ptr + region->off, lua_tostring(L, idx), siz);
+}
+
+int
+luacs_get_strptr(lua_State *L, struct luacobject *obj,
+    struct luacregion *region)
+{
+	lua_pushstring(L, *(const char **)(obj->ptr + region->off));
+	return (1);
+}
+
+void
+luacs_set_strptr(lua_State *L __unused,
+    struct luacobject *obj __unused, struct luacregion *region __unused,
+    int idx __unused)
+{
+	/* pointers to a string are readonly */
+	LUACS_ASSERT(L, 0);
+}
+
+int
+luacs_get_wstring(lua_State *L, struct luacobject *obj,
+    struct luacregion *region)
+{
+	wchar_t		*wstr, *wstr0;
+	char		 buf[128];
+	size_t		 wstrlen, wstrmax;
+
+	wstr = (wchar_t *)(obj->ptr + region->off);
+	wstrmax = region->size / sizeof(wchar_t);
+	wstrlen = wcsnlen(wstr, wstrmax);
+	if (wstrlen == wstrmax) {
+		wstrmax++;	/* for the null character */
+		if ((wstr0 = calloc(sizeof(wchar_t), wstrmax)) == NULL) {
+			strerror_r(errno, buf, sizeof(buf));
+			lua_pushstring(L, buf);
+			lua_error(L);
 		}
+		memcpy(wstr0, wstr, wstrlen * sizeof(wchar_t));
+		wstr0[wstrlen] = L'\0';
+		luacs_pushwstring(L, wstr0);
+		free(wstr0);
+	} else
+		luacs_pushwstring(L, wstr);
+
+	return (1);
+}
+
+void
+luacs_set_wstring(lua_State *L, struct luacobject *obj,
+    struct luacregion *region, int idx)
+{
+	size_t	wstrsiz;
+
+	luaL_checkstring(L, idx);
+	if ((wstrsiz = mbstowcs(NULL, lua_tostring(L, idx), 0)) ==
+	    (size_t)-1) {
+		luaL_error(L,
+		    "the string contains an invalid character");
+		abort();
 	}
-		break;
-	case LUACS_TSTRING:
-	case LUACS_TBYTEARRAY:
-		luaL_checklstring(L, absidx, &siz);
-		luaL_argcheck(L, siz <= region->size, absidx, "too long");
-		siz = MINIMUM(siz, region->size);
-		memcpy(obj->ptr + region->off, lua_tostring(L, absidx), siz);
-		if (region->type == LUACS_TSTRING && siz < region->size)
-			*(char *)(obj->ptr + region->off + siz) = '\0';
-		break;
-	case LUACS_TWSTRING:
-	    {
-		size_t	wstrsiz;
-
-		luaL_checkstring(L, absidx);
-		if ((wstrsiz = mbstowcs(NULL, lua_tostring(L, absidx), 0)) ==
-		    (size_t)-1) {
-			luaL_error(L,
-			    "the string contains an invalid character");
-			abort();
-		}
-		wstrsiz *= sizeof(wchar_t);
-		luaL_argcheck(L, wstrsiz <= region->size, absidx, "too long");
-		if (mbstowcs((wchar_t *)(obj->ptr + region->off),
-		    lua_tostring(L, absidx), wstrsiz) == (size_t)-1) {
-			luaL_error(L,
-			    "the string contains an invalid character");
-			abort();
+	wstrsiz *= sizeof(wchar_t);
+	luaL_argcheck(L, wstrsiz <= region->size, idx, "too long");
+	if (mbstowcs((wchar_t *)(obj->ptr + region->off),
+	    lua_tostring(L, idx), wstrsiz) == (size_t)-1) {
+		luaL_error(L,
+		    "the string contains an invalid character");
+		abort();
+	}
+	if (wstrsiz + sizeof(wchar_t) <= region->size)
+		*(wchar_t *)(obj->ptr + region->off + wstrsiz) = L'\0';
+}
+
+int
+luacs_get_wstrptr(lua_State *L, struct luacobject *obj,
+    struct luacregion *region)
+{
+	return (luacs_pushwstring(L,
+	    *(const wchar_t **)(obj->ptr + region->off)));
+}
+
+void
+luacs_set_wstrptr(lua_State *L __unused,
+    struct luacobject *obj __unused, struct luacregion *region __unused,
+    int idx __unused)
+{
+	/* pointers to a string are readonly */
+	LUACS_ASSERT(L, 0);
+}
+
+int
+luacs_pushenum(lua_State *L, struct luacregion *region, intmax_t value)
+{
+	struct luacenum_value	*val;
+	struct luacenum		*ce;
+
+	/* typref is checked to be an enum when it's declared */
+	luacs_getref(L, region->typref);
+	ce = lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	val = luacs_enum_get0(ce, value);
+	if (val == NULL)
+		lua_pushinteger(L, value);
+	else
+		luacs_getref(L, val->ref);
+
+	return (1);
+}
+
+intmax_t
+luacs_toenum(lua_State *L, struct luacregion *region, int idx)
+{
+	struct luacenum		*ce;
+	struct luacenum_value	*val;
+	intmax_t		 value;
+
+	luacs_getref(L, region->typref);
+	ce = lua_touserdata(L, -1);
+	if (lua_type(L, idx) == LUA_TNUMBER) {
+		value = lua_tointeger(L, idx);
+		if (luacs_enum_get0(ce, value) == NULL) {
+			lua_pushfstring(L,
+			    "must be a valid integer for `enum %s'",
+			    ce->enumname);
+			lua_error(L);
 		}
-		if (wstrsiz + sizeof(wchar_t) <= region->size)
-			*(wchar_t *)(obj->ptr + region->off + wstrsiz) = L'\0';
-		break;
-	    }
-	case LUACS_TOBJREF:
-	case LUACS_TOBJENT:
-	case LUACS_TEXTREF:
-		LUACS_ASSERT(L, 0);
-		break;
-	default:
-		lua_pushnil(L);
-		break;
+	} else if (lua_type(L, idx) == LUA_TUSERDATA) {
+		lua_pushcclosure(L, luacs_enum_memberof, 1);
+		lua_pushvalue(L, idx);
+		lua_call(L, 1, 1);
+		if (!lua_toboolean(L, -1))
+			luaL_error(L, "must be a member of `enum %s",
+			    ce->enumname);
+		val = lua_touserdata(L, idx);
+		value = val->value;
+	} else {
+		luaL_error(L, "must be a member of `enum %s", ce->enumname);
+		/* NOTREACHED */
+		abort();
 	}
+	lua_pop(L, 1);
+
+	return (value);
+}
+
+int
+luacs_get_enum_broken(lua_State *L,
+    struct luacobject *obj __unused, struct luacregion *region __unused)
+{
+	luaL_error(L, "%s: obj is broken", __func__);
+	/* NOTREACHED */
+	abort();
+}
+
+void
+luacs_set_enum_broken(lua_State *L,
+    struct luacobject *obj __unused, struct luacregion *region __unused,
+    int idx __unused)
+{
+	luaL_error(L, "%s: obj is broken", __func__);
+}
+
+int
+luacs_get_none(lua_State *L, struct luacobject *obj __unused,
+    struct luacregion *region __unused)
+{
+	lua_pushnil(L);
+	return (1);
+}
+
+void
+luacs_set_none(lua_State *L __unused, struct luacobject *obj __unused,
+    struct luacregion *region __unused, int idx __unused)
+{
+	LUACS_ASSERT(L, 0);
 }
 
 /* enum */
@@ -1954,8 +4326,7 @@ luacs_newenum0(lua_State *L, const char *ename, size_t valwidth)
 		lua_setfield(L, -2, "__gc");
 		lua_pushcfunction(L, luacs_enum__index);
 		lua_setfield(L, -2, "__index");
-		lua_pushcfunction(L, luacs_enum__next);
-		lua_pushcclosure(L, luacs_enum__pairs, 1);
+		lua_pushcfunction(L, luacs_enum__pairs);
 		lua_setfield(L, -2, "__pairs");
 	}
 	lua_setmetatable(L, -2);
@@ -2076,11 +4447,15 @@ luacs_enum__index(lua_State *L)
 	return (1);
 }
 
+/*
+ * The iterator keeps the enum and the last value in the upvalues, so that
+ * it doesn't need to find the value by the given label usually.
+ */
 int
 luacs_enum__next(lua_State *L)
 {
 	struct luacenum		*ce;
-	struct luacenum_value	*val, vkey;
+	struct luacenum_value	*val = NULL, vkey;
 
 	lua_settop(L, 2);
 	ce = luacs_checkenum(L, 1);
@@ -2088,8 +4463,12 @@ luacs_enum__next(lua_State *L)
 		val= SPLAY_MIN(luacenum_values, &ce->values);
 	else {
 		vkey.label = luaL_checkstring(L, 2);
+		/* the values are alive while the enum is referred */
+		if (lua_rawequal(L, 1, lua_upvalueindex(1)))
+			val = lua_touserdata(L, lua_upvalueindex(2));
 		/* don't confuse.  key is label, sort by value */
-		val = SPLAY_FIND(luacenum_labels, &ce->labels, &vkey);
+		if (val == NULL || strcmp(val->label, vkey.label) != 0)
+			val = SPLAY_FIND(luacenum_labels, &ce->labels, &vkey);
 		if (val != NULL)
 			val = SPLAY_NEXT(luacenum_values, &ce->values, val);
 	}
@@ -2097,6 +4476,8 @@ luacs_enum__next(lua_State *L)
 		lua_pushnil(L);
 		return (1);
 	}
+	lua_pushlightuserdata(L, val);
+	lua_replace(L, lua_upvalueindex(2));
 	lua_pushstring(L, val->label);
 	luacs_getref(L, val->ref);
 
@@ -2108,7 +4489,9 @@ luacs_enum__pairs(lua_State *L)
 {
 	lua_settop(L, 1);
 	luacs_checkenum(L, 1);
-	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_pushvalue(L, 1);
+	lua_pushlightuserdata(L, NULL);
+	lua_pushcclosure(L, luacs_enum__next, 2);
 	lua_pushvalue(L, 1);
 	lua_pushnil(L);
 
@@ -2290,17 +4673,25 @@ luacs_checkenumval(lua_State *L, int idx, const char *enumname)
 }
 
 /* refs */
+void
+luacs_pushregistry(lua_State *L)
+{
+	lua_pushlightuserdata(L, (void *)&luacs_registry_key);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+}
+
 int
 luacs_ref(lua_State *L)
 {
 	int	 ret;
 
-	lua_getfield(L, LUA_REGISTRYINDEX, LUACS_REGISTRY_NAME);
+	luacs_pushregistry(L);
 	if (lua_isnil(L, -1)) {
 		lua_pop(L, 1);
 		lua_newtable(L);
-		lua_setfield(L, LUA_REGISTRYINDEX, LUACS_REGISTRY_NAME);
-		lua_getfield(L, LUA_REGISTRYINDEX, LUACS_REGISTRY_NAME);
+		lua_pushlightuserdata(L, (void *)&luacs_registry_key);
+		lua_pushvalue(L, -2);
+		lua_rawset(L, LUA_REGISTRYINDEX);
 	}
 	lua_pushvalue(L, -2);
 	ret = luaL_ref(L, -2);
@@ -2312,7 +4703,7 @@ luacs_ref(lua_State *L)
 int
 luacs_getref(lua_State *L, int ref)
 {
-	lua_getfield(L, LUA_REGISTRYINDEX, LUACS_REGISTRY_NAME);
+	luacs_pushregistry(L);
 	if (lua_isnil(L, -1))
 		return (1);
 	lua_rawgeti(L, -1, ref);
@@ -2323,7 +4714,7 @@ luacs_getref(lua_State *L, int ref)
 int
 luacs_unref(lua_State *L, int ref)
 {
-	lua_getfield(L, LUA_REGISTRYINDEX, LUACS_REGISTRY_NAME);
+	luacs_pushregistry(L);
 	luaL_unref(L, -1, ref);
 	lua_pop(L, 1);
 
@@ -2331,6 +4722,17 @@ luacs_unref(lua_State *L, int ref)
 }
 
 /* utilities */
+uint32_t
+luacs_strhash(const char *str)
+{
+	uint32_t	 hash = 2166136261U;	/* FNV-1a */
+
+	for (; *str != '\0'; str++)
+		hash = (hash ^ (unsigned char)*str) * 16777619U;
+
+	return (hash);
+}
+
 int
 luacs_pushwstring(lua_State *L, const wchar_t *wstr)
 {
@@ -2364,6 +4766,5 @@ luacs_pushwstring(lua_State *L, const wchar_t *wstr)
 	return (1);
 }
 
-SPLAY_GENERATE(luacstruct_fields, luacstruct_field, tree, luacstruct_field_cmp);
 SPLAY_GENERATE(luacenum_labels, luacenum_value, treel, luacenum_label_cmp);
 SPLAY_GENERATE(luacenum_values, luacenum_value, treev, luacenum_value_cmp);
@@ -51,19 +51,32 @@ enum luacstruct_type {
 #define LUACS_FENDIANLITTLE	0x04
 #define LUACS_FENDIAN		(LUACS_FENDIANBIG | LUACS_FENDIANLITTLE)
 
+typedef struct luacstruct	*luacs_typehandle_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 int	 luacs_newstruct0(lua_State *, const char *, const char *);
+int	 luacs_newstruct1(lua_State *, const char *, const char *, size_t);
 int	 luacs_declare_method(lua_State *, const char *, int (*)(lua_State *));
 int	 luacs_declare_const(lua_State *, const char *, int);
+int	 luacs_declare_alias(lua_State *, const char *, const char *,
+	    unsigned);
+int	 luacs_declare_identity(lua_State *, bool);
 int	 luacs_delstruct(lua_State *, const char *);
 int	 luacs_declare_field(lua_State *, enum luacstruct_type,
 	    const char *, const char *, size_t, int, int, unsigned);
 int	 luacs_newobject(lua_State *, const char *, void *);
+luacs_typehandle_t
+	 luacs_gettype(lua_State *, const char *);
+int	 luacs_newobject_h(lua_State *, luacs_typehandle_t, void *);
+void	*luacs_checkobject_h(lua_State *, int, luacs_typehandle_t);
 void	*luacs_object_pointer(lua_State *, int, const char *);
 void	 luacs_object_clear(lua_State *, int);
+void	 luacs_object_fromtable(lua_State *, int, int);
+int	 luacs_newborrowed(lua_State *, const char *);
+void	 luacs_object_bind(lua_State *, int, void *);
 int	 luacs_object_typename(lua_State *);
 void	*luacs_checkobject(lua_State *, int, const char *);
 int	 luacs_newenum0(lua_State *, const char *, size_t);
@@ -85,6 +98,11 @@ int	 luacs_newarraytype(lua_State *, const char *, enum luacstruct_type,
 		{ struct _typename; /* check valid for type */}	\
 		luacs_newstruct0((_L), #_typename, NULL);	\
 	} while(0/*CONSTCOND*/)
+#define luacs_newstruct_sized(_L, _typename)			\
+	do {							\
+		luacs_newstruct1((_L), #_typename, NULL,	\
+		    sizeof(struct _typename));			\
+	} while(0/*CONSTCOND*/)
 #define luacs_newenum(_L, _enumname)				\
 	do {							\
 		{ enum _enumname; /* check valid for enum */}	\
@@ -207,17 +225,24 @@ int	 luacs_newarraytype(lua_State *, const char *, enum luacstruct_type,
 		    offsetof(struct _type, _field), 0, _flags);	\
 	} while (0/*CONSTCOND*/)
 /*
- * When using Lua 5.1 and the pseudo value might reference the parent object,
- * you need to explicitly clear the value or call luacs_object_clear().
- * luacstruct uses a weak reference to manage the reference from the object to
- * the pseudo values, but since a weak table in Lua 5.1 is not an ephemeron
- * table, it doesn't work properly.
+ * The pseudo values are kept by the uservalue of the object, so a value
+ * referencing the parent object doesn't keep it alive.  luacs_object_clear()
+ * releases the values explicitly.
  */
 #define luacs_pseudo_field(_L, _type, _field, _flags)		\
 	do {							\
 		luacs_declare_field((_L), LUACS_TEXTREF, NULL,	\
 		    #_field, 0, 0, 0, _flags);		\
 	} while (0/*CONSTCOND*/)
+/*
+ * Declare the field `_name' which refers the field at `_path' like
+ * "sin_addr.s_addr" in the nested structs or the arrays of them directly.
+ */
+#define luacs_alias_field(_L, _type, _name, _path, _flags)	\
+	do {							\
+		{ struct _type; /* check valid for type */}	\
+		luacs_declare_alias((_L), (_name), (_path), _flags);\
+	} while (0/*CONSTCOND*/)
 
 #define	_nitems(_x)		(sizeof(_x) / sizeof((_x)[0]))
 
@@ -261,7 +286,7 @@ int	 luacs_newarraytype(lua_State *, const char *, enum luacstruct_type,
 		    sizeof((struct _type *)0)->_field[0]),	\
 		    "`"#_field"' is an unsupported int type");	\
 		luacs_declare_field((_L), LUACS_TENUM, #_etype,	\
-		    #_field, sizeof(((struct _type *)0)->_field),\
+		    #_field, sizeof(((struct _type *)0)->_field[0]),\
 		    offsetof(struct _type, _field),		\
 		    _nitems(((struct _type *)0)->_field), _flags);\
 	} while (0/*CONSTCOND*/)
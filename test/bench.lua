@@ -0,0 +1,340 @@
+local test_bench = require("test_bench")
+
+-- take the best of 3 trials
+local run = function(name, n, func)
+    local best
+    for i = 1, 3 do
+	local t0 = os.clock()
+	func(n)
+	local t = os.clock() - t0
+	if best == nil or t < best then
+	    best = t
+	end
+    end
+    print(string.format("%-32s %10.0f ops/sec", name, n / best))
+end
+
+local main = function()
+    --
+    -- object churn, first not to be affected by the peak of the others
+    --
+    run("object churn", 10000000, function(n)
+	test_bench.churn(n)
+    end)
+    print(string.format("%-32s %10d KB", "peak RSS", test_bench.maxrss()))
+    run("push object by name", 4000000, function(n)
+	test_bench.push(n, false)
+    end)
+    run("push object by type handle", 4000000, function(n)
+	test_bench.push(n, true)
+    end)
+    run("push object with identity", 4000000, function(n)
+	test_bench.push(n, true, true)
+    end)
+
+    local objs = test_bench.objects(1000000)
+    local t0 = os.clock()
+    collectgarbage()
+    print(string.format("%-32s %10.1f ms", "full gc (1M user tables)",
+	(os.clock() - t0) * 1000))
+    objs = nil
+    collectgarbage()
+
+    -- the user tables caching the arrays of the fields
+    local kb0 = collectgarbage("count")
+    objs = test_bench.nested(100000)
+    for _, o in ipairs(objs) do
+	local _ = o.a, o.b, o.c, o.d
+    end
+    collectgarbage()
+    print(string.format("%-32s %10.0f bytes", "object with 4 cached arrays",
+	(collectgarbage("count") - kb0) * 1024 / #objs))
+    local o = objs[1]
+    run("cached array read", 4000000, function(n)
+	local x
+	for i = 1, n, 4 do
+	    x = o.a; x = o.b; x = o.c; x = o.d
+	end
+    end)
+    objs = nil
+    collectgarbage()
+
+    --
+    -- field reads
+    --
+    for _, nfields in ipairs({8, 64, 512}) do
+	local obj = test_bench.struct(nfields)
+	run(string.format("object churn (%d fields)", nfields), 1000000,
+	    function(n)
+		test_bench.churn(n, "bench" .. nfields)
+	    end)
+	local names = {}
+	for i = 1, nfields do
+	    names[i] = "f" .. i
+	    obj[names[i]] = i
+	end
+	run(string.format("field read (%d fields)", nfields), 4000000,
+	    function(n)
+		local sum, m = 0, #names
+		for i = 1, n do
+		    sum = sum + obj[names[i % m + 1]]
+		end
+		assert(sum > 0)
+	    end)
+	run(string.format("field read hot (%d fields)", nfields), 4000000,
+	    function(n)
+		local sum = 0
+		for i = 1, n, 4 do
+		    sum = sum + obj.f1 + obj.f2 + obj.f3 + obj.f4
+		end
+		assert(sum > 0)
+	    end)
+	-- shuffle to avoid favoring the locality of the access
+	local shuffled = {}
+	for i = 1, 1024 do
+	    shuffled[i] = names[(i * 7919) % nfields + 1]
+	end
+	run(string.format("field read random (%d fields)", nfields),
+	    4000000, function(n)
+		local sum = 0
+		for i = 1, n do
+		    sum = sum + obj[shuffled[i % 1024 + 1]]
+		end
+		assert(sum > 0)
+	    end)
+    end
+
+    --
+    -- methods and constants
+    --
+    local obj, T = test_bench.struct(64)
+    for i = 1, 4 do
+	obj["f" .. i] = i
+    end
+    local o1, o2, o3, o4 = T.ordinal("f1"), T.ordinal("f2"),
+	T.ordinal("f3"), T.ordinal("f4")
+    run("field read by ordinal", 4000000, function(n)
+	local sum = 0
+	for i = 1, n, 4 do
+	    sum = sum + obj[o1] + obj[o2] + obj[o3] + obj[o4]
+	end
+	assert(sum > 0)
+    end)
+    run("field read by name", 4000000, function(n)
+	local sum = 0
+	for i = 1, n, 4 do
+	    sum = sum + obj.f1 + obj.f2 + obj.f3 + obj.f4
+	end
+	assert(sum > 0)
+    end)
+    run("method call", 4000000, function(n)
+	for i = 1, n do
+	    obj:nop()
+	end
+    end)
+    run("const read", 4000000, function(n)
+	local sum = 0
+	for i = 1, n do
+	    sum = sum + obj.ONE
+	end
+	assert(sum == n)
+    end)
+
+    run("get 4 fields", 4000000, function(n)
+	local sum = 0
+	for i = 1, n, 4 do
+	    local a, b, c, d = obj:get("f1", "f2", "f3", "f4")
+	    sum = sum + a + b + c + d
+	end
+	assert(sum > 0)
+    end)
+
+    local t = {f1 = 1, f2 = 2, f3 = 3, f4 = 4}
+    run("set 4 fields", 4000000, function(n)
+	for i = 1, n, 4 do
+	    obj:set(t)
+	end
+    end)
+    run("set 4 fields by __newindex", 4000000, function(n)
+	for i = 1, n, 4 do
+	    for k, v in pairs(t) do
+		obj[k] = v
+	    end
+	end
+    end)
+
+    run("totable (64 fields)", 200000, function(n)
+	for i = 1, n do
+	    obj:totable()
+	end
+    end)
+    run("pairs to table (64 fields)", 200000, function(n)
+	for i = 1, n do
+	    local t = {}
+	    for k, v in pairs(obj) do
+		t[k] = v
+	    end
+	end
+    end)
+
+    --
+    -- callbacks
+    --
+    local sum = 0
+    local callback = function(ev)
+	sum = sum + ev.id
+    end
+    run("callback with new object", 2000000, function(n)
+	test_bench.events(n, false, callback)
+	collectgarbage()
+    end)
+    run("callback with borrowed object", 2000000, function(n)
+	test_bench.events(n, true, callback)
+	collectgarbage()
+    end)
+
+    --
+    -- array copies
+    --
+    local c1, c2 = test_bench.counters()
+    run("copy 4096 counters", 20000, function(n)
+	for i = 1, n do
+	    c1.counters = c2.counters
+	end
+    end)
+    run("copy 4096 counters swapped", 20000, function(n)
+	for i = 1, n do
+	    c1.counters = c2.becounters
+	end
+    end)
+    run("256 counters window by slice", 200000, function(n)
+	local counters = c1.counters
+	for i = 1, n do
+	    local w = counters:slice(i % 3840 + 1, i % 3840 + 256)
+	end
+    end)
+    run("256 counters window by table", 20000, function(n)
+	local counters = c1.counters
+	for i = 1, n do
+	    local w, off = {}, i % 3840
+	    for j = 1, 256 do
+		w[j] = counters[off + j]
+	    end
+	end
+    end)
+    run("4096 counters to table", 2000, function(n)
+	for i = 1, n do
+	    local t = c1.counters:totable()
+	end
+    end)
+    run("4096 counters to table by ipairs", 2000, function(n)
+	for i = 1, n do
+	    local t = {}
+	    for j, v in ipairs(c1.counters) do
+		t[j] = v
+	    end
+	end
+    end)
+    local t = c1.counters:totable()
+    run("4096 counters from table", 2000, function(n)
+	for i = 1, n do
+	    c2.counters:fromtable(t)
+	end
+    end)
+    run("4096 counters from table by loop", 2000, function(n)
+	for i = 1, n do
+	    local counters = c2.counters
+	    for j = 1, #t do
+		counters[j] = t[j]
+	    end
+	end
+    end)
+    c1.counters:fromtable(t)
+    for j = 1, #t do
+	c1.counters[j] = j
+	c1.becounters[j] = j
+    end
+    run("sum 4096 counters", 20000, function(n)
+	for i = 1, n do
+	    assert(c1.counters:sum() > 0)
+	end
+    end)
+    run("sum 4096 counters swapped", 20000, function(n)
+	for i = 1, n do
+	    assert(c1.becounters:sum() > 0)
+	end
+    end)
+    run("sum 4096 counters by loop", 2000, function(n)
+	for i = 1, n do
+	    local sum, counters = 0, c1.counters
+	    for j = 1, #counters do
+		sum = sum + counters[j]
+	    end
+	    assert(sum > 0)
+	end
+    end)
+    run("max 4096 counters", 20000, function(n)
+	for i = 1, n do
+	    assert(c1.counters:max() == 4096)
+	end
+    end)
+    run("count 4096 counters", 20000, function(n)
+	for i = 1, n do
+	    assert(c1.counters:count(7) == 1)
+	end
+    end)
+    run("fill 4096 counters", 20000, function(n)
+	for i = 1, n do
+	    c2.counters:fill(0)
+	end
+    end)
+    for j = 1, 4096 do
+	c1.counters[j] = (j * 7919) % 4096
+    end
+    run("sort 4096 counters", 2000, function(n)
+	for i = 1, n do
+	    c2.counters = c1.counters
+	    c2.counters:sort()
+	end
+    end)
+    run("sort 4096 counters by table", 2000, function(n)
+	for i = 1, n do
+	    c2.counters = c1.counters
+	    local t = c2.counters:totable()
+	    table.sort(t)
+	    c2.counters:fromtable(t)
+	end
+    end)
+    run("bsearch 4096 counters", 2000000, function(n)
+	local counters = c2.counters
+	for i = 1, n do
+	    assert(counters:bsearch(i % 4096) ~= nil)
+	end
+    end)
+
+    --
+    -- enum reads
+    --
+    local eobj = test_bench.enum()
+    eobj.color = 3
+    for i = 1, 4 do
+	eobj.colors[i] = i % 3 + 1
+    end
+    run("enum field read", 4000000, function(n)
+	local c
+	for i = 1, n do
+	    c = eobj.color
+	end
+	assert(c ~= nil)
+    end)
+    local colors = eobj.colors
+    run("enum array read", 4000000, function(n)
+	local c
+	for i = 1, n do
+	    c = colors[i % 4 + 1]
+	end
+	assert(c ~= nil)
+    end)
+end
+
+main()
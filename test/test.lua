@@ -72,13 +72,21 @@ local main = function()
     --
     -- nested structure
     --
-    local nest = test_extra.test_nest()
+    local nest, derived = test_extra.test_nest()
     assert(nest)
     assert(nest.a == 1)
     assert(nest.b == 2)
     assert(nest.nest)
     assert(nest.nest.x == 3)
     assert(nest.nest.y == 4)
+    -- aliases
+    assert(nest.nx == 3 and nest.ny == 4)
+    nest.nx = 5
+    assert(nest.nest.x == 5)
+    assert(not pcall(function() nest.ny = 6 end))
+    assert(derived.nx == 5 and derived.ny == 4)
+    derived.nx = 3
+    assert(nest.nest.x == 3)
     function try()
 	nest.nest = ref
     end
@@ -104,6 +112,13 @@ local main = function()
     ext.extras.counter = ext.extras.counter + 1
     assert(ext.extras)
     assert(ext.extras.counter == 2)
+    -- the pseudo value referencing the object doesn't keep it
+    local weak = setmetatable({}, {__mode = "v"})
+    weak[1] = test_extra.test_ext()
+    weak[1].extras = {parent = weak[1]}
+    collectgarbage()
+    collectgarbage()
+    assert(weak[1] == nil)
 
     local color,m = test_extra.test_enum()
     assert(m.color == color.BLUE)
@@ -118,6 +133,11 @@ local main = function()
     assert(m.invalid_color)
     -- we can use as a number
     assert(type(m.invalid_color) == "number")
+    -- array of enum
+    assert(#m.colors == 3)
+    assert(m.colors[2] == color.GREEN)
+    m.colors[3] = color.BLUE
+    assert(m.colors[3] == color.BLUE)
     -- check iteratable
     iter = pairs(color)
     k, v = iter(color, nil)
@@ -128,11 +148,44 @@ local main = function()
     assert(k == "BLUE")
     k, v = iter(color, k)
     assert(k == nil)
+    assert(iter(color, "RED") == "GREEN")
+    assert(iter(color, "BLUE") == nil)
+    assert(iter(color, "GREEN") == "BLUE")
     -- extra functions
     assert(color.get(1) == color.GREEN)
     assert(color.memberof(color.GREEN))
     assert(color.GREEN:tointeger() == 1)
     m.color = color.BLUE
+    -- bulk assignment
+    m:set({x = 1, y = 2, color = color.RED})
+    assert(m.x == 1 and m.y == 2 and m.color == color.RED)
+    -- fails atomically
+    rv = pcall(m.set, m, {x = 3, nosuch = 1})
+    assert(not rv and m.x == 1)
+    rv = pcall(m.set, m, {x = 3, y = 4, color = 101})
+    assert(not rv and m.x == 1 and m.y == 2 and m.color == color.RED)
+    -- sort and binary search by enum and bool
+    m.colors:fromtable({color.BLUE, color.RED, color.GREEN})
+    m.colors:sort()
+    assert(m.colors[1] == color.RED and m.colors[3] == color.BLUE)
+    assert(m.colors:bsearch(color.GREEN) == 2 and m.colors:bsearch(1) == 2)
+    m.colors:sort(true)
+    assert(m.colors[1] == color.BLUE and m.colors[3] == color.RED)
+    m.becolors:sort()
+    assert(m.becolors[1] == color.RED and m.becolors[3] == color.BLUE)
+    assert(m.becolors:bsearch(color.BLUE) == 3)
+    m.flags:fromtable({true, false, true})
+    m.flags:sort()
+    assert(m.flags[1] == false and m.flags[2] == true)
+    assert(m.flags:bsearch(true) == 2 and m.flags:bsearch(false) == 1)
+    m.items[1].color, m.items[2].color, m.items[3].color =
+	color.BLUE, color.RED, color.GREEN
+    m.items[1].on, m.items[2].on, m.items[3].on = true, false, true
+    m.items:sort_by("color")
+    assert(m.items[1].color == color.RED and m.items[3].color == color.BLUE)
+    m.items:sort_by("on", true)
+    assert(m.items[1].color == color.GREEN and m.items[2].color == color.BLUE)
+    assert(m.items[3].on == false)
 
     --print(color)
     --print(color.RED)
@@ -168,6 +221,10 @@ local main = function()
     assert(m1.fuga2 == f2)
     m1.fuga2.id = 100
     assert(f2.id == 100)
+    m2:set({id = 7, fuga2 = f2, fuga1 = f1})
+    assert(m2.id == 7 and m2.fuga2 == f2 and m2.fuga1.id == f1.id)
+    rv = pcall(m2.set, m2, {id = 8, name = "m2"})	-- name is readonly
+    assert(not rv and m2.id == 7)
     -- assigning different type must be refused
     local r, e = pcall(function()
 	m1.fuga2 = m2
@@ -179,7 +236,7 @@ local main = function()
     -- the same since fuga is copy
     assert(m1.fuga2.pseudo == f2.pseudo)
 
-    local m1,m2,int8a,int8b = test_extra.test_array()
+    local m1,m2,int8a,int8b,array_main = test_extra.test_array()
     -- check __len
     assert(#m1.int4 == 4)
     assert(#m1.sub2 == 2)
@@ -273,6 +330,91 @@ local main = function()
     assert(m2.ext2[1] == "hello")
     assert(m2.ext2[2] == "world")
 
+    -- totable
+    local t = m1:totable()
+    assert(t.int4 == m1.int4 and t.sub3 == m1.sub3)
+    t = m1:totable(3)
+    assert(#t.int4 == 4 and t.int4[1] == 9 and t.int4[4] == 6)
+    assert(t.sub2[1] == m1.sub2[1])	-- references are not converted
+    assert(type(t.sub3[3]) == "table" and t.sub3[3].x == 41)
+    assert(t.ext2[1] == "hello" and t.ext2[2] == "world")
+    t = m1:totable(2)
+    assert(type(t.intxy) == "table" and t.intxy[1] ~= nil)
+    assert(type(t.intxy[1]) ~= "table")
+    assert(m1:totable(3).intxy[3][3] == m1.intxy[3][3])
+    -- copy the arrays of arrays
+    m1.intxy[3][1] = 31
+    m2.intxy = m1.intxy
+    assert(m2.intxy[3][1] == 31 and m2.intxy[3][3] == m1.intxy[3][3])
+    -- slices share the memory
+    local sl = m1.int4:slice(2, 3)
+    assert(#sl == 2 and sl[1] == m1.int4[2] and sl[2] == m1.int4[3])
+    sl[1] = 99
+    assert(m1.int4[2] == 99)
+    assert(#m1.int4:slice() == 4 and #m1.int4:slice(3) == 2)
+    assert(#m1.int4:slice(5) == 0 and #m1.int4:slice(2, 1) == 0)
+    assert(not pcall(m1.int4.slice, m1.int4, 0))
+    assert(not pcall(m1.int4.slice, m1.int4, 2, 5))
+    assert(not pcall(m1.ext2.slice, m1.ext2))
+    assert(not pcall(m1.sub2.slice, m1.sub2, 2, 2))
+    assert(m1.sub3:slice(2)[1].x == m1.sub3[2].x)
+    assert(m1.intxy:slice(3)[1][1] == 31)
+    assert(sl:slice(2)[1] == m1.int4[3])
+    -- the slice keeps the array
+    local weak = setmetatable({}, {__mode = "v"})
+    weak[1] = int8a:slice(2, 2)
+    int8a[2] = 5
+    weak[2] = int8a
+    local sl2 = weak[1]
+    int8a = nil
+    collectgarbage()
+    collectgarbage()
+    assert(weak[2] ~= nil and sl2[1] == 5)
+    int8a = weak[2]
+    sl2 = nil
+    -- conversions from and to tables
+    local t4 = m1.int4:totable()
+    assert(#t4 == 4 and t4[2] == 99 and t4[4] == m1.int4[4])
+    m1.int4:fromtable({5, 6, 7})
+    assert(m1.int4[1] == 5 and m1.int4[3] == 7 and m1.int4[4] == t4[4])
+    assert(not pcall(m1.int4.fromtable, m1.int4, {1, 2, 3, 4, 5}))
+    assert(m1.int4[1] == 5)
+    m1.int4:fromtable(t4)
+    assert(m1.int4[2] == 99)
+    assert(m1.intxy:totable(2)[3][1] == 31)
+    m2.sub3:fromtable({m1.sub3[3]})
+    assert(m2.sub3[1].x == m1.sub3[3].x)
+    assert(not pcall(m2.sub3.fromtable, m2.sub3, {m1.sub3[1], m1}))
+    assert(m2.sub3[1].x == m1.sub3[3].x)
+    m2.intxy:fromtable({m1.intxy[3]})
+    assert(m2.intxy[1][1] == 31)
+    -- the members are restored on an error
+    assert(not pcall(m2.intxy.fromtable, m2.intxy, {m1.intxy[2],
+        m1.int4}))
+    assert(m2.intxy[1][1] == 31)
+    m1.ext2:fromtable({"a", "b"})
+    assert(m1.ext2[1] == "a" and m1.ext2[2] == "b")
+
+    -- field handles
+    local h = array_main.field("sub3[3].y")
+    assert(h:get(m1) == m1.sub3[3].y)
+    h:set(m1, 77)
+    assert(m1.sub3[3].y == 77)
+    h = array_main.field("sub2[2].z")	-- through the pointer
+    assert(h:get(m1) == m1.sub2[2].z)
+    h:set(m1, 78)
+    assert(m1.sub2[2].z == 78)
+    assert(h:get(m2) == m2.sub2[2].z)
+    h = array_main.field("intxy[2][3]")
+    h:set(m1, 79)
+    assert(m1.intxy[2][3] == 79 and h:get(m1) == 79)
+    assert(array_main.field("int4[1]"):get(m1) == m1.int4[1])
+    for _, path in ipairs({"sub3", "sub3[4].x", "sub3[1]x", "int4.x",
+	"nosuch", "ext2[1]", "[1]", ""}) do
+	assert(not pcall(array_main.field, path))
+    end
+    assert(not pcall(h.get, h, int8a))
+
     assert(#int8a == 8);
     assert(#int8b == 8);
     for i=1,#int8a do
@@ -293,6 +435,41 @@ local main = function()
 	    assert(v == i * 2)
 	    i = i + 1
     end
+    -- reductions
+    assert(int8a:sum() == 72 and int8a:min() == 2 and int8a:max() == 16)
+    assert(int8a:find(6) == 3 and int8a:find(6, 4) == nil)
+    assert(int8a:find(5) == nil and int8a:count(4) == 1)
+    int8a[8] = -3
+    assert(int8a:min() == -3 and int8a:sum() == 53)
+    int8a:fill(7)
+    assert(int8a:count(7) == 8 and int8a:sum() == 56 and int8a[8] == 7)
+    int8a:slice(3, 5):fill(-1)
+    assert(int8a:count(-1) == 3 and int8a:find(-1) == 3)
+    assert(int8a:slice(1, 0):min() == nil and int8a:slice(1, 0):sum() == 0)
+    assert(not pcall(m1.sub3.sum, m1.sub3))
+    -- sort and binary search
+    int8a:fromtable({5, -2, 9, 0, -7, 5, 3, 1})
+    int8a:sort()
+    assert(table.concat(int8a:totable(), ",") == "-7,-2,0,1,3,5,5,9")
+    assert(int8a:bsearch(5) == 6 and int8a:bsearch(-7) == 1)
+    assert(int8a:bsearch(4) == nil and int8a:bsearch(10) == nil)
+    int8a:sort(true)
+    assert(table.concat(int8a:totable(), ",") == "9,5,5,3,1,0,-2,-7")
+    int8a:slice(2, 4):sort()
+    assert(table.concat(int8a:totable(), ",") == "9,3,5,5,1,0,-2,-7")
+    m2.sub3[1].x, m2.sub3[2].x, m2.sub3[3].x = 3, 1, 2
+    m2.sub3[1].y, m2.sub3[2].y, m2.sub3[3].y = 30, 10, 20
+    m2.sub3:sort_by("x")
+    assert(m2.sub3[1].x == 1 and m2.sub3[1].y == 10)
+    assert(m2.sub3[3].x == 3 and m2.sub3[3].y == 30)
+    m2.sub3:sort_by("y", true)
+    assert(m2.sub3[1].y == 30 and m2.sub3[3].x == 1)
+    m2.sub3[1].x, m2.sub3[2].x, m2.sub3[3].x = 5, 5, 5
+    m2.sub3:sort_by("x")	-- stable
+    assert(m2.sub3[1].y == 30 and m2.sub3[2].y == 20)
+    assert(not pcall(m2.sub3.sort_by, m2.sub3, "nosuch"))
+    assert(not pcall(m2.int4.sort_by, m2.int4, "x"))
+    assert(not pcall(m2.sub3.sort, m2.sub3))
 
     yamada = test_extra.test_tostring_const()
     assert(tostring(yamada) == "yamada(168,63)")
@@ -307,6 +484,153 @@ local main = function()
     assert(yamada.UNITED_STATES == 1)
     rv = pcall(function() yamada.UNITED_STATES = 81 end)
     assert(not rv)
+    local h, w, n, c = yamada:get("height", "weight", "nosuch", "JAPAN")
+    assert(h == 168 and w == 63 and n == nil and c == 81)
+    assert(select("#", yamada:get()) == 0)
+
+    -- many fields
+    local f, fields_main = test_extra.test_fields()
+    for i = 2, 40 do
+	if i ~= 20 then
+	    f["v" .. i] = i
+	end
+    end
+    for i = 2, 40 do
+	assert(f["v" .. i] == (i == 20 and 0 or i))
+    end
+    assert(f.v41 == nil)
+    rv = pcall(function() f.v1 = 1 end)
+    assert(not rv)
+    rv = pcall(function() f.v20 = 1 end)
+    assert(not rv)
+    local n = 0
+    for k, v in pairs(f) do
+	n = n + 1
+    end
+    assert(n == 41)	-- 40 fields and a constant
+    -- the iterator can continue from any field
+    local iter = pairs(f)
+    assert(iter(f, nil) ~= nil)
+    assert(iter(f, "v10") == "v11")
+    assert(iter(f, "v11") == "v12")
+    assert(iter(f, "nosuch") == nil)
+    assert(f.get == 7)	-- declared names override the builtin methods
+    -- ordinals
+    local o = fields_main.ordinal("v12")
+    assert(type(o) == "number" and f[o] == 12)
+    f[o] = 112
+    assert(f.v12 == 112 and f[o] == 112)
+    assert(fields_main.ordinal("nosuch") == nil)
+    assert(f[fields_main.ordinal("get")] == 7)
+    assert(f[0] == nil and f[100] == nil)
+    assert(not pcall(function() f[100] = 1 end))
+    assert(not pcall(function() f[fields_main.ordinal("v1")] = 1 end))
+    -- borrowed objects
+    local saved, n = nil, 0
+    local sub, subs, sub2, vals
+    local cached = setmetatable({}, {__mode = "v"})
+    local ev = test_extra.test_borrow(function(ev)
+	assert(saved == nil or ev == saved)
+	assert(ev.pseudo == nil)
+	-- the nested objects taken for the previous event are released
+	assert(sub == nil or not pcall(function() return sub.x end))
+	assert(vals == nil or not pcall(function() return vals[1] end))
+	ev.pseudo = {id = ev.id}
+	cached[ev.id] = ev.pseudo
+	ev.count = ev.id * 10
+	sub, subs, sub2, vals = ev.sub, ev.subs, ev.subs[2], ev.vals
+	assert(sub.x == ev.id and sub2.x == ev.id and vals[1] == ev.id)
+	assert(not pcall(vals.slice, vals, 1, 1))
+	saved = ev
+	n = n + 1
+    end)
+    assert(n == 3 and ev == saved)
+    -- the values cached for the instances are not kept
+    sub, subs, sub2, vals = nil, nil, nil, nil
+    collectgarbage()
+    collectgarbage()
+    assert(next(cached) == nil)
+    assert(not pcall(function() return sub.x end))
+    assert(not pcall(function() sub.x = 1 end))
+    assert(not pcall(function() return subs[1] end))
+    assert(not pcall(function() return #subs end))
+    assert(not pcall(function() return sub2.x end))
+    assert(not pcall(function() return vals[1] end))
+    assert(not pcall(function() vals[1] = 1 end))
+    assert(not pcall(function() return vals:totable() end))
+    assert(not pcall(function() return ev.id end))
+    assert(not pcall(function() ev.id = 1 end))
+    assert(not pcall(function() return ev:totable() end))
+    assert(tostring(ev) == "struct borrow_event: released")
+    -- the object keeps the struct
+    local d = test_extra.test_delstruct()
+    collectgarbage()
+    collectgarbage()
+    d.x = 5
+    assert(d.x == 5 and d:totable().x == 5)
+    assert(not delstruct_collected)
+    d = nil
+    collectgarbage()
+    collectgarbage()
+    assert(delstruct_collected)
+    -- sized struct
+    assert(test_extra.test_sized().x == 1)
+    -- type handles
+    local hobj = test_extra.test_typehandle()
+    assert(hobj.x == 3)
+    test_extra.test_typehandle(hobj)
+    assert(not pcall(test_extra.test_typehandle, yamada))
+    assert(not pcall(test_extra.test_typehandle, {}))
+    -- identities of the objects
+    local i1, i2 = test_extra.test_identity(true)
+    assert(rawequal(i1, i2) and i1.x == 5)
+    i1.x = 6
+    local i3 = test_extra.test_identity(true)
+    assert(rawequal(i1, i3) and i3.x == 6)
+    i1, i2 = test_extra.test_identity(false)
+    assert(not rawequal(i1, i2) and i1.x == 6 and i2.x == 6)
+    -- byte order
+    local e = test_extra.test_endian()
+    assert(e.be16 == -2)
+    assert(e.be32 == 0x01020304)
+    assert(e.le32 == 0x01020304)
+    assert(e.be16s[2] == -2)
+    e.be16 = -300
+    assert(e.be16 == -300)
+    e.be16s[1] = 0x1234
+    assert(e.be16s[1] == 0x1234)
+    -- copy arrays of the different byte orders
+    e.h16s = e.be16s
+    assert(e.h16s[1] == 0x1234 and e.h16s[2] == -2)
+    e.le16s = e.be16s
+    assert(e.le16s[1] == 0x1234 and e.le16s[2] == -2)
+    e.h16s[1] = 7
+    e.be16s = e.h16s
+    assert(e.be16s[1] == 7 and e.be16s[2] == -2)
+    e.be64s[1] = 0x010203040506
+    e.be64s[2] = 9
+    e.h64s = e.be64s
+    assert(e.h64s[1] == 0x010203040506 and e.h64s[2] == 9)
+    -- reductions respect the byte order
+    e.be16s:fill(0x0102)
+    e.be16s[2] = -300
+    assert(e.be16s[1] == 0x0102 and e.be16s:sum() == 0x0102 - 300)
+    assert(e.be16s:min() == -300 and e.be16s:max() == 0x0102)
+    assert(e.be16s:find(-300) == 2 and e.be16s:count(0x0102) == 1)
+    assert(e.be16s:find(0x0201) == nil and e.be16s:count(70000) == 0)
+    assert(e.be64s:max() == 0x010203040506 and e.be64s:find(9) == 2)
+    e.be16s:sort()
+    assert(e.be16s[1] == -300 and e.be16s[2] == 0x0102)
+    assert(e.be16s:bsearch(0x0102) == 2 and e.be16s:bsearch(0x0201) == nil)
+    e.be64s:sort()
+    assert(e.be64s[1] == 9 and e.be64s:bsearch(0x010203040506) == 2)
+
+    -- metamethods check the type of the object
+    assert(getmetatable(f).__index(yamada, "height") == 168)
+    rv = pcall(getmetatable(f).__index, {}, "v2")
+    assert(not rv)
+    rv = pcall(getmetatable(f).__newindex, io.stdout, "v2", 0)
+    assert(not rv)
 
 end
 
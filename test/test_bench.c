@@ -0,0 +1,306 @@
+#include <sys/resource.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <lua.h>
+#include <lauxlib.h>
+#include "luacstruct.h"
+
+#include "test_subr.h"
+
+static int l_bench_struct(lua_State *);
+static int l_bench_nop(lua_State *);
+static int l_bench_enum(lua_State *);
+static int l_bench_events(lua_State *);
+static int l_bench_churn(lua_State *);
+static int l_bench_push(lua_State *);
+static int l_bench_maxrss(lua_State *);
+static int l_bench_objects(lua_State *);
+static int l_bench_nested(lua_State *);
+static int l_bench_counters(lua_State *);
+
+EXPORT
+int
+luaopen_test_bench(lua_State *L)
+{
+#define REGISTER(_L, _funcname, _cfunc)			\
+	do {						\
+		lua_pushcfunction((_L), (_cfunc));	\
+		lua_setfield((_L), -2, (_funcname));	\
+	} while (0/*CONSTCOND*/)
+
+	lua_newtable(L);
+
+	REGISTER(L, "struct", l_bench_struct);
+	REGISTER(L, "enum", l_bench_enum);
+	REGISTER(L, "events", l_bench_events);
+	REGISTER(L, "churn", l_bench_churn);
+	REGISTER(L, "push", l_bench_push);
+	REGISTER(L, "maxrss", l_bench_maxrss);
+	REGISTER(L, "objects", l_bench_objects);
+	REGISTER(L, "nested", l_bench_nested);
+	REGISTER(L, "counters", l_bench_counters);
+
+	return (1);
+}
+
+/*
+ * Create an object of the struct which has `n' int32 fields named "f1",
+ * "f2", ... "fn", a method "nop" and a constant "ONE".  The struct is
+ * returned as well.
+ */
+int
+l_bench_struct(lua_State *L)
+{
+	int	 i, nfields;
+	char	 tname[32], fname[32];
+
+	nfields = luaL_checkinteger(L, 1);
+	snprintf(tname, sizeof(tname), "bench%d", nfields);
+	luacs_newstruct0(L, tname, NULL);
+	for (i = 0; i < nfields; i++) {
+		snprintf(fname, sizeof(fname), "f%d", i + 1);
+		luacs_declare_field(L, LUACS_TINT32, NULL, fname,
+		    sizeof(int32_t), i * sizeof(int32_t), 0, 0);
+	}
+	luacs_declare_method(L, "nop", l_bench_nop);
+	luacs_declare_const(L, "ONE", 1);
+	luacs_newobject(L, tname, NULL);
+	lua_insert(L, -2);
+
+	return (2);
+}
+
+int
+l_bench_nop(lua_State *L)
+{
+	return (0);
+}
+
+/*
+ * Create an object of the struct which has an enum field "color" and an
+ * array field "colors" of the enum.
+ */
+int
+l_bench_enum(lua_State *L)
+{
+	enum BENCH_COLOR { RED = 1, GREEN, BLUE };
+	struct bench_enum {
+		enum BENCH_COLOR	color;
+		enum BENCH_COLOR	colors[4];
+	};
+
+	luacs_newenum(L, BENCH_COLOR);
+	luacs_enum_declare_value(L, "RED", RED);
+	luacs_enum_declare_value(L, "GREEN", GREEN);
+	luacs_enum_declare_value(L, "BLUE", BLUE);
+	lua_pop(L, 1);
+
+	luacs_newstruct(L, bench_enum);
+	luacs_enum_field(L, bench_enum, BENCH_COLOR, color, 0);
+	luacs_enum_array_field(L, bench_enum, BENCH_COLOR, colors, 0);
+	lua_pop(L, 1);
+	luacs_newobject(L, "bench_enum", NULL);
+
+	return (1);
+}
+
+/*
+ * Call the function `n' times with an object of the event, which is created
+ * for each call or is borrowed if `borrowed' is true.
+ */
+int
+l_bench_events(lua_State *L)
+{
+	struct bench_event {
+		int	id;
+	} ev;
+	int	 i, n, borrowed;
+
+	n = luaL_checkinteger(L, 1);
+	borrowed = lua_toboolean(L, 2);
+	lua_settop(L, 3);
+	luacs_newstruct(L, bench_event);
+	luacs_int_field(L, bench_event, id, 0);
+	lua_pop(L, 1);
+
+	luacs_newborrowed(L, "bench_event");
+	for (i = 0; i < n; i++) {
+		ev.id = i;
+		lua_pushvalue(L, 3);
+		if (borrowed) {
+			luacs_object_bind(L, 4, &ev);
+			lua_pushvalue(L, 4);
+		} else
+			luacs_newobject(L, "bench_event", &ev);
+		lua_call(L, 1, 0);
+		if (borrowed)
+			luacs_object_bind(L, 4, NULL);
+	}
+
+	return (0);
+}
+
+/*
+ * Create and drop `n' objects of the struct of the name, a small struct by
+ * default.
+ */
+int
+l_bench_churn(lua_State *L)
+{
+	struct bench_churn {
+		int	id;
+	};
+	int		 i, n;
+	const char	*tname;
+
+	n = luaL_checkinteger(L, 1);
+	tname = luaL_optstring(L, 2, "bench_churn");
+	luacs_newstruct(L, bench_churn);
+	luacs_int_field(L, bench_churn, id, 0);
+	lua_pop(L, 1);
+
+	for (i = 0; i < n; i++) {
+		luacs_newobject(L, tname, NULL);
+		lua_pop(L, 1);
+	}
+
+	return (0);
+}
+
+/*
+ * Push `n' objects for a C pointer, by the type handle if `byhandle' is
+ * true, otherwise by the name.  The objects are kept by the identities if
+ * `identity' is true.
+ */
+int
+l_bench_push(lua_State *L)
+{
+	struct bench_push {
+		int	id;
+	} p;
+	int			 i, n, byhandle, identity;
+	const char		*tname;
+	luacs_typehandle_t	 h;
+
+	n = luaL_checkinteger(L, 1);
+	byhandle = lua_toboolean(L, 2);
+	identity = lua_toboolean(L, 3);
+	tname = (identity)? "bench_ident" : "bench_push";
+	luacs_newstruct0(L, tname, NULL);
+	luacs_declare_field(L, LUACS_TINT32, NULL, "id", sizeof(int),
+	    offsetof(struct bench_push, id), 0, 0);
+	if (identity)
+		luacs_declare_identity(L, true);
+	lua_pop(L, 1);
+
+	h = luacs_gettype(L, tname);
+	for (i = 0; i < n; i++) {
+		if (byhandle)
+			luacs_newobject_h(L, h, &p);
+		else
+			luacs_newobject(L, tname, &p);
+		lua_pop(L, 1);
+	}
+
+	return (0);
+}
+
+/* Return the peak resident set size in KB */
+int
+l_bench_maxrss(lua_State *L)
+{
+	struct rusage	 ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	lua_pushinteger(L, ru.ru_maxrss);
+
+	return (1);
+}
+
+/*
+ * Return a table of `n' objects whose pseudo field "extra" is set, so that
+ * each of them has its user table.
+ */
+int
+l_bench_objects(lua_State *L)
+{
+	struct bench_objects {
+		int	id;
+	};
+	int	 i, n;
+
+	n = luaL_checkinteger(L, 1);
+	luacs_newstruct(L, bench_objects);
+	luacs_int_field(L, bench_objects, id, 0);
+	luacs_pseudo_field(L, bench_objects, extra, 0);
+	lua_pop(L, 1);
+
+	lua_createtable(L, n, 0);
+	for (i = 0; i < n; i++) {
+		luacs_newobject(L, "bench_objects", NULL);
+		lua_pushboolean(L, 1);
+		lua_setfield(L, -2, "extra");
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	return (1);
+}
+
+/*
+ * Return a table of `n' objects of the struct which has 4 array fields "a",
+ * "b", "c" and "d".
+ */
+int
+l_bench_nested(lua_State *L)
+{
+	struct bench_nested {
+		int	a[2];
+		int	b[2];
+		int	c[2];
+		int	d[2];
+	};
+	int	 i, n;
+
+	n = luaL_checkinteger(L, 1);
+	luacs_newstruct(L, bench_nested);
+	luacs_int_array_field(L, bench_nested, a, 0);
+	luacs_int_array_field(L, bench_nested, b, 0);
+	luacs_int_array_field(L, bench_nested, c, 0);
+	luacs_int_array_field(L, bench_nested, d, 0);
+	lua_pop(L, 1);
+
+	lua_createtable(L, n, 0);
+	for (i = 0; i < n; i++) {
+		luacs_newobject(L, "bench_nested", NULL);
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	return (1);
+}
+
+/*
+ * Return 2 objects of the struct which has 4096 uint32 counters "counters"
+ * in the host byte order and "becounters" in the big endian.
+ */
+int
+l_bench_counters(lua_State *L)
+{
+	struct bench_counters {
+		uint32_t	counters[4096];
+		uint32_t	becounters[4096];
+	};
+
+	luacs_newstruct(L, bench_counters);
+	luacs_declare_field(L, LUACS_TUINT32, NULL, "counters",
+	    sizeof(uint32_t), offsetof(struct bench_counters, counters), 4096,
+	    0);
+	luacs_declare_field(L, LUACS_TUINT32, NULL, "becounters",
+	    sizeof(uint32_t), offsetof(struct bench_counters, becounters), 4096,
+	    LUACS_FENDIANBIG);
+	lua_pop(L, 1);
+	luacs_newobject(L, "bench_counters", NULL);
+	luacs_newobject(L, "bench_counters", NULL);
+
+	return (2);
+}
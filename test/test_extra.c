@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <lua.h>
+#include <lauxlib.h>
 #include "luacstruct.h"
 
 #include "test_subr.h"
@@ -8,6 +9,9 @@
 #ifndef static_assert
 #define static_assert(_cond, _msg) ((void)0)
 #endif
+#if LUA_VERSION_NUM == 501
+#define lua_rawlen(_x, _i)	lua_objlen((_x), (_i))
+#endif
 
 static int l_test_ref(lua_State *);
 static int l_test_nest(lua_State *);
@@ -16,6 +20,14 @@ static int l_test_enum(lua_State *);
 static int l_test_copy(lua_State *);
 static int l_test_array(lua_State *);
 static int l_test_tostring_const(lua_State *);
+static int l_test_fields(lua_State *);
+static int l_test_endian(lua_State *);
+static int l_test_borrow(lua_State *);
+static int l_test_delstruct(lua_State *);
+static int l_test_delstruct_gc(lua_State *);
+static int l_test_sized(lua_State *);
+static int l_test_typehandle(lua_State *);
+static int l_test_identity(lua_State *);
 
 EXPORT
 int
@@ -36,6 +48,13 @@ luaopen_test_extra(lua_State *L)
 	REGISTER(L, "test_copy", l_test_copy);
 	REGISTER(L, "test_array", l_test_array);
 	REGISTER(L, "test_tostring_const", l_test_tostring_const);
+	REGISTER(L, "test_fields", l_test_fields);
+	REGISTER(L, "test_endian", l_test_endian);
+	REGISTER(L, "test_borrow", l_test_borrow);
+	REGISTER(L, "test_delstruct", l_test_delstruct);
+	REGISTER(L, "test_sized", l_test_sized);
+	REGISTER(L, "test_typehandle", l_test_typehandle);
+	REGISTER(L, "test_identity", l_test_identity);
 	REGISTER(L, "typename", luacs_object_typename);
 
 	return (1);
@@ -98,8 +117,14 @@ l_test_nest(lua_State *L)
 	luacs_int_field(L, nest_main, a, 0);
 	luacs_int_field(L, nest_main, b, 0);
 	luacs_nested_field(L, nest_main, nest_sub, nest, 0);
+	luacs_alias_field(L, nest_main, "nx", "nest.x", 0);
+	luacs_alias_field(L, nest_main, "ny", "nest.y", LUACS_FREADONLY);
 	lua_pop(L, 2);
 
+	/* inherits the aliases */
+	luacs_newstruct0(L, "nest_derived", "nest_main");
+	lua_pop(L, 1);
+
 	m = calloc(1, sizeof(struct nest_main));
 	m->a = 1;
 	m->b = 2;
@@ -107,8 +132,9 @@ l_test_nest(lua_State *L)
 	m->nest.y = 4;
 
 	luacs_newobject(L, "nest_main", m);
+	luacs_newobject(L, "nest_derived", m);
 
-	return (1);
+	return (2);
 }
 
 int
@@ -144,6 +170,11 @@ l_test_enum(lua_State *L)
 		GREEN,
 		BLUE = 0x100000000ULL
 	};
+	struct enum_item {
+		enum COLOR
+			color;
+		bool	on;
+	};
 	struct enum_main {
 		int	x;
 		int	y;
@@ -152,6 +183,11 @@ l_test_enum(lua_State *L)
 			color;
 		enum COLOR
 			invalid_color;
+		enum COLOR
+			colors[3];
+		bool	flags[3];
+		struct enum_item
+			items[3];
 	} *m;
 
 	luacs_newenum(L, COLOR);
@@ -159,13 +195,24 @@ l_test_enum(lua_State *L)
 	luacs_enum_declare_value(L, "GREEN", GREEN);
 	luacs_enum_declare_value(L, "BLUE", BLUE);
 
+	luacs_newstruct(L, enum_item);
+	luacs_enum_field(L, enum_item, COLOR, color, 0);
+	luacs_bool_field(L, enum_item, on, 0);
+
 	luacs_newstruct(L, enum_main);
 	luacs_int_field(L, enum_main, x, 0);
 	luacs_int_field(L, enum_main, y, 0);
 	luacs_int_field(L, enum_main, z, 0);
 	luacs_enum_field(L, enum_main, COLOR, color, 0);
 	luacs_enum_field(L, enum_main, COLOR, invalid_color, 0);
-	lua_pop(L, 1);
+	luacs_enum_array_field(L, enum_main, COLOR, colors, 0);
+	/* the flags for the byte order are ignored for enums */
+	luacs_declare_field(L, LUACS_TENUM, "COLOR", "becolors",
+	    sizeof(enum COLOR), offsetof(struct enum_main, colors), 3,
+	    LUACS_FENDIANBIG);
+	luacs_bool_array_field(L, enum_main, flags, 0);
+	luacs_nested_array_field(L, enum_main, enum_item, items, 0);
+	lua_pop(L, 2);
 
 	m = calloc(1, sizeof(struct enum_main));
 	m->x = 100;
@@ -173,6 +220,7 @@ l_test_enum(lua_State *L)
 	m->z = BLUE;
 	m->color = BLUE;
 	m->invalid_color = 99;
+	m->colors[1] = GREEN;
 	luacs_newobject(L, "enum_main", m);
 
 	return (2);
@@ -298,8 +346,10 @@ l_test_array(lua_State *L)
 	luacs_newarray(L, LUACS_TINT32, NULL, sizeof(int32_t), 8, 0,
 	    calloc(8, sizeof(int32_t)));
 
+	/* the struct for the field handles */
+	luacs_newstruct0(L, "array_main", NULL);
 
-	return (4);
+	return (5);
 }
 
 struct person {
@@ -356,3 +406,247 @@ l_test_tostring_const(lua_State *L)
 
 	return (1);
 }
+
+int
+l_test_fields(lua_State *L)
+{
+	struct fields_main {
+		int	v[40];
+	};
+	int	 i;
+	char	 name[32];
+
+	/* enough fields to grow the field index several times */
+	luacs_newstruct(L, fields_main);
+	/* v40 is declared as a constant first, then replaced by the field */
+	luacs_declare_const(L, "v40", 99);
+	for (i = 0; i < 40; i++) {
+		snprintf(name, sizeof(name), "v%d", i + 1);
+		luacs_declare_field(L, LUACS_TINT32, NULL, name,
+		    sizeof(int), i * sizeof(int), 0, 0);
+	}
+	/* redeclare v1 and v20 as readonly */
+	luacs_declare_field(L, LUACS_TINT32, NULL, "v1", sizeof(int), 0, 0,
+	    LUACS_FREADONLY);
+	luacs_declare_field(L, LUACS_TINT32, NULL, "v20", sizeof(int),
+	    19 * sizeof(int), 0, LUACS_FREADONLY);
+	luacs_declare_const(L, "get", 7);
+
+	luacs_newobject(L, "fields_main", NULL);
+	lua_insert(L, -2);
+
+	return (2);
+}
+
+int
+l_test_endian(lua_State *L)
+{
+	struct endian_main {
+		int16_t		be16;
+		uint32_t	be32;
+		int32_t		le32;
+		int16_t		be16s[2];
+		int16_t		h16s[2];
+		int16_t		le16s[2];
+		uint64_t	be64s[2];
+		uint64_t	h64s[2];
+	} *m;
+	static const uint8_t
+			be16[] = { 0xff, 0xfe },
+			be32[] = { 0x01, 0x02, 0x03, 0x04 },
+			le32[] = { 0x04, 0x03, 0x02, 0x01 };
+
+	luacs_newstruct(L, endian_main);
+	luacs_declare_field(L, LUACS_TINT16, NULL, "be16", sizeof(int16_t),
+	    offsetof(struct endian_main, be16), 0, LUACS_FENDIANBIG);
+	luacs_declare_field(L, LUACS_TUINT32, NULL, "be32", sizeof(uint32_t),
+	    offsetof(struct endian_main, be32), 0, LUACS_FENDIANBIG);
+	luacs_declare_field(L, LUACS_TINT32, NULL, "le32", sizeof(int32_t),
+	    offsetof(struct endian_main, le32), 0, LUACS_FENDIANLITTLE);
+	luacs_declare_field(L, LUACS_TINT16, NULL, "be16s", sizeof(int16_t),
+	    offsetof(struct endian_main, be16s), 2, LUACS_FENDIANBIG);
+	luacs_declare_field(L, LUACS_TINT16, NULL, "h16s", sizeof(int16_t),
+	    offsetof(struct endian_main, h16s), 2, 0);
+	luacs_declare_field(L, LUACS_TINT16, NULL, "le16s", sizeof(int16_t),
+	    offsetof(struct endian_main, le16s), 2, LUACS_FENDIANLITTLE);
+	luacs_declare_field(L, LUACS_TUINT64, NULL, "be64s", sizeof(uint64_t),
+	    offsetof(struct endian_main, be64s), 2, LUACS_FENDIANBIG);
+	luacs_declare_field(L, LUACS_TUINT64, NULL, "h64s", sizeof(uint64_t),
+	    offsetof(struct endian_main, h64s), 2, 0);
+	lua_pop(L, 1);
+
+	m = calloc(1, sizeof(struct endian_main));
+	memcpy(&m->be16, be16, sizeof(be16));
+	memcpy(&m->be32, be32, sizeof(be32));
+	memcpy(&m->le32, le32, sizeof(le32));
+	memcpy(&m->be16s[1], be16, sizeof(be16));
+	luacs_newobject(L, "endian_main", m);
+
+	return (1);
+}
+
+/*
+ * Call the function for the events with the same borrowed object, then
+ * return the object after released.
+ */
+int
+l_test_borrow(lua_State *L)
+{
+	struct borrow_sub {
+		int	x;
+	};
+	struct borrow_event {
+		int	id;
+		int	count;
+		struct borrow_sub
+			sub;
+		struct borrow_sub
+			subs[2];
+		int	vals[2];
+	} evs[3];
+	int	 i;
+
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	luacs_newstruct(L, borrow_sub);
+	luacs_int_field(L, borrow_sub, x, 0);
+	luacs_newstruct(L, borrow_event);
+	luacs_int_field(L, borrow_event, id, 0);
+	luacs_int_field(L, borrow_event, count, 0);
+	luacs_nested_field(L, borrow_event, borrow_sub, sub, 0);
+	luacs_nested_array_field(L, borrow_event, borrow_sub, subs, 0);
+	luacs_int_array_field(L, borrow_event, vals, 0);
+	luacs_pseudo_field(L, borrow_event, pseudo, 0);
+	lua_pop(L, 2);
+
+	luacs_newborrowed(L, "borrow_event");
+	for (i = 0; i < (int)(sizeof(evs) / sizeof(evs[0])); i++) {
+		memset(&evs[i], 0, sizeof(evs[i]));
+		evs[i].id = i + 1;
+		evs[i].sub.x = evs[i].id;
+		evs[i].subs[1].x = evs[i].id;
+		evs[i].vals[0] = evs[i].id;
+		luacs_object_bind(L, 2, &evs[i]);
+		lua_pushvalue(L, 1);
+		lua_pushvalue(L, 2);
+		lua_call(L, 1, 0);
+		luacs_object_bind(L, 2, NULL);
+	}
+	for (i = 0; i < (int)(sizeof(evs) / sizeof(evs[0])); i++)
+		ASSERT(L, evs[i].count == evs[i].id * 10);
+
+	return (1);
+}
+
+/*
+ * Return an object of the struct which is deleted already.  The global
+ * `delstruct_collected' is set when the object is collected.
+ */
+int
+l_test_delstruct(lua_State *L)
+{
+	struct delstruct_main {
+		int	x;
+	};
+
+	luacs_newstruct(L, delstruct_main);
+	luacs_int_field(L, delstruct_main, x, 0);
+	luacs_declare_method(L, "__gc", l_test_delstruct_gc);
+	lua_pop(L, 1);
+	luacs_newobject(L, "delstruct_main", NULL);
+	luacs_delstruct(L, "delstruct_main");
+
+	return (1);
+}
+
+int
+l_test_delstruct_gc(lua_State *L)
+{
+	lua_pushboolean(L, 1);
+	lua_setglobal(L, "delstruct_collected");
+
+	return (0);
+}
+
+/* Return an object owning the struct which has undeclared tail */
+int
+l_test_sized(lua_State *L)
+{
+	struct sized_main {
+		int	x;
+		char	tail[61];
+	} *m;
+
+	luacs_newstruct_sized(L, sized_main);
+	luacs_int_field(L, sized_main, x, 0);
+	lua_pop(L, 1);
+	luacs_newobject(L, "sized_main", NULL);
+	ASSERT(L, lua_rawlen(L, -1) >= sizeof(struct sized_main));
+	m = luacs_object_pointer(L, -1, "sized_main");
+	ASSERT(L, m != NULL);
+	m->x = 1;
+	m->tail[sizeof(m->tail) - 1] = 1;
+
+	return (1);
+}
+
+/*
+ * Return an object created by the type handle, or check the argument is an
+ * object of the struct if given.
+ */
+int
+l_test_typehandle(lua_State *L)
+{
+	struct handle_main {
+		int	x;
+	};
+	static struct handle_main	 m = { 3 };
+	luacs_typehandle_t		 h;
+
+	luacs_newstruct(L, handle_main);
+	luacs_int_field(L, handle_main, x, 0);
+	lua_pop(L, 1);
+
+	ASSERT(L, luacs_gettype(L, "nosuch") == NULL);
+	h = luacs_gettype(L, "handle_main");
+	ASSERT(L, h != NULL && h == luacs_gettype(L, "handle_main"));
+	if (lua_gettop(L) > 0) {
+		luacs_checkobject_h(L, 1, h);
+		return (0);
+	}
+	luacs_newobject_h(L, h, &m);
+	ASSERT(L, luacs_checkobject_h(L, -1, h) == &m);
+	luacs_newobject(L, "handle_main", &m);
+	ASSERT(L, luacs_checkobject_h(L, -1, h) == &m);
+	lua_pop(L, 1);
+
+	return (1);
+}
+
+/*
+ * Return the objects for the same instance twice, of the struct keeping the
+ * identities if `identity' is true.
+ */
+int
+l_test_identity(lua_State *L)
+{
+	struct ident_main {
+		int	x;
+	};
+	static struct ident_main	 m = { 5 };
+	const char			*tname;
+	int				 identity;
+
+	identity = lua_toboolean(L, 1);
+	tname = (identity)? "ident_main" : "ident_plain";
+	luacs_newstruct0(L, tname, NULL);
+	luacs_declare_field(L, LUACS_TINT32, NULL, "x", sizeof(int),
+	    offsetof(struct ident_main, x), 0, 0);
+	if (identity)
+		luacs_declare_identity(L, true);
+	lua_pop(L, 1);
+
+	luacs_newobject(L, tname, &m);
+	luacs_newobject(L, tname, &m);
+
+	return (2);
+}